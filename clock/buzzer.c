@@ -0,0 +1,124 @@
+/**************************
+ * file name: buzzer.c
+ **************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include "buzzer.h"
+
+#define BUZZER_ON() BUZZER_PORT &= ~(1<<BUZZER_PIN)
+#define BUZZER_OFF() BUZZER_PORT |= (1<<BUZZER_PIN)
+
+/*******************************************************************
+  Beep patterns: durations in 10ms, alternating on and off starting
+  with on, terminated by 0.
+********************************************************************/
+static const uint8_t beepSingle[] PROGMEM = {15, 15, 0};
+static const uint8_t beepDouble[] PROGMEM = {15, 10, 15, 15, 0};
+static const uint8_t beepConfirm[] PROGMEM = {4, 4, 0};
+static const uint8_t beepAlarm1[] PROGMEM = {15, 85, 0};
+static const uint8_t beepAlarm2[] PROGMEM = {15, 10, 15, 60, 0};
+static const uint8_t beepAlarm3[] PROGMEM = {15, 5, 15, 5, 15, 5, 15, 25, 0};
+
+static const uint8_t * const buzzerPatterns[] PROGMEM =
+{
+    beepSingle,     //BEEP_SINGLE
+    beepDouble,     //BEEP_DOUBLE
+    beepConfirm,    //BEEP_CONFIRM
+    beepAlarm1,     //BEEP_ALARM1
+    beepAlarm2,     //BEEP_ALARM2
+    beepAlarm3      //BEEP_ALARM3
+};
+
+#define BUZZER_IDLE 0xff
+
+//State of the playing pattern, owned by buzzer_tick() while it runs
+static const uint8_t *buzzer_start;
+static const uint8_t *buzzer_step;
+static uint8_t buzzer_time;
+static volatile uint8_t buzzer_pattern = BUZZER_IDLE;
+static uint8_t buzzer_looping;
+
+//Switch to the next step of the pattern, restart or stop at its end
+static void buzzer_next(void)
+{
+    uint8_t time = pgm_read_byte(buzzer_step);
+
+    if (time == 0)
+    {
+        if (!buzzer_looping)
+        {
+            BUZZER_OFF();
+            buzzer_pattern = BUZZER_IDLE;
+            return;
+        }
+        buzzer_step = buzzer_start;
+        time = pgm_read_byte(buzzer_step);
+    }
+
+    //even steps are on, odd steps are off
+    if ((uint8_t)(buzzer_step - buzzer_start) & 1)
+        BUZZER_OFF();
+    else
+        BUZZER_ON();
+    buzzer_step++;
+    buzzer_time = time;
+}
+
+
+//Start "pattern" from its first step
+static void buzzer_begin(uint8_t pattern, uint8_t looping)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+    buzzer_start = (const uint8_t *)pgm_read_word(&buzzerPatterns[pattern]);
+    buzzer_step = buzzer_start;
+    buzzer_pattern = pattern;
+    buzzer_looping = looping;
+    buzzer_next();
+    SREG = sreg;
+}
+
+void buzzer_init(void)
+{
+    BUZZER_OFF();
+    BUZZER_DDR |= (1<<BUZZER_PIN);
+}
+
+//The first step of a pattern can be up to one tick shorter, it starts between two ticks
+void buzzer_tick(void)
+{
+    if (buzzer_pattern != BUZZER_IDLE && --buzzer_time == 0)
+        buzzer_next();
+}
+
+void buzzer_play(uint8_t pattern)
+{
+    buzzer_begin(pattern, 0);
+}
+
+void buzzer_loop(uint8_t pattern)
+{
+    if (buzzer_looping && buzzer_pattern == pattern)
+        return;
+    buzzer_begin(pattern, 1);
+}
+
+void buzzer_stop(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+    BUZZER_OFF();
+    buzzer_pattern = BUZZER_IDLE;
+    buzzer_looping = 0;
+    SREG = sreg;
+}
+
+uint8_t buzzer_busy(void)
+{
+    return buzzer_pattern != BUZZER_IDLE;
+}
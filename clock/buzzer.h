@@ -0,0 +1,40 @@
+/******************************
+ * file name: buzzer.h
+ ******************************/
+#ifndef BUZZER_H
+#define BUZZER_H
+
+#include <stdint.h>
+
+//Buzzer pin, active low
+#define BUZZER_PORT PORTB
+#define BUZZER_DDR DDRB
+#define BUZZER_PIN 4
+
+//Beep patterns, see buzzerPatterns in buzzer.c
+#define BEEP_SINGLE 0       //one 150ms beep
+#define BEEP_DOUBLE 1       //two short beeps
+#define BEEP_CONFIRM 2      //short chirp after a setting was stored
+#define BEEP_ALARM1 3       //alarm, first minute
+#define BEEP_ALARM2 4       //alarm, louder after one minute
+#define BEEP_ALARM3 5       //alarm, nearly continuous after three minutes
+
+//Interface function to set up the buzzer pin, the patterns are stepped by buzzer_tick()
+void buzzer_init(void);
+
+//Interface function to step the playing pattern, called every 10ms from the ms time base
+void buzzer_tick(void);
+
+//Interface function to play "pattern" once, replaces a playing pattern
+void buzzer_play(uint8_t pattern);
+
+//Interface function to play "pattern" in a loop until buzzer_stop(), keeps running if already looping it
+void buzzer_loop(uint8_t pattern);
+
+//Interface function to stop the buzzer at once
+void buzzer_stop(void);
+
+//Interface function returning 1 while a pattern is played
+uint8_t buzzer_busy(void);
+
+#endif
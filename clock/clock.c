@@ -26,6 +26,9 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <string.h>
 //#define F_CPU 12000000L
 #include <util/delay.h>
 // 03.11.2018 -> HZ Ha&Au
@@ -34,6 +37,9 @@
 #include "ds1621.h"
 #include "ds18b20.h"
 #include "rtc.h"
+#include "eequeue.h"
+#include "buzzer.h"
+#include "multiplex.h"
 
 #define TEMPCORRECTION	3
 
@@ -44,6 +50,12 @@
 #define DIFFDATE_MODULE
 #define LEDS_SHOW_HOURMIN
 #define LEDS_CASE9
+// PWMDIM_MODULE and ASM_MULTIPLEX: see multiplex.h
+//#define PROFILE_MODULE
+
+#if defined(ASM_MULTIPLEX) && defined(PROFILE_MODULE)
+#error "PROFILE_MODULE times the slot ISR in C, build it without ASM_MULTIPLEX"
+#endif
 
 
 //keys definition
@@ -51,6 +63,26 @@
 #define KEYSET 		2
 #define KPIN  		PIND
 
+//key debouncer, sampled every 10ms in the Timer0 ISR, times in 10ms
+#define KEY_PLUS		1				// SELECT key
+#define KEY_MODE		2				// SET key
+#define KEY_BOTH		3				// both keys pressed together
+#define KEYDEBOUNCE		3				// a key change must be stable for this long
+#define KEYLONG			125				// held this long -> long press, again every KEYLONG while held
+#define KEYREPEATDELAY	25				// first repeat while held
+#define KEYREPEAT		25				// following repeats
+#define KEYFAST			150				// PLUS held this long in a numeric set mode -> fast repeats
+#define KEYREPEATFAST	8
+#define KEYJUMP			250				// PLUS held this long in a numeric set mode -> repeats step by 10
+#define KEYQUEUE		4				// queued key events, power of two
+
+//key events, or'ed with KEY_xx
+#define KEV_JUMP		0x04			// with KEV_REPEAT: step by 10
+#define KEV_PRESS		0x10
+#define KEV_RELEASE		0x20
+#define KEV_LONG		0x40			// every KEYLONG while held, steps the MODE menu
+#define KEV_REPEAT		0x80
+
 
 //segment definitions
 #define SEG_NULL	0x00
@@ -63,6 +95,15 @@
 #define SEG_g 		0x40
 #define SEG_dot	0x80
 
+//entries of the MODE menu, MODE held in SHOWCLOCK steps through them, released enters
+#define MENU_NONE		0
+#define MENU_DATE		1				// show the date
+#define MENU_ALARM		2				// set the alarm
+#define MENU_SECMODE	3				// set the led mode
+#define MENU_DIM		4				// set the dim mode
+#define MENU_REFRESH	5				// set the refresh profile
+#define MENU_CLOCK		6				// set the date and time
+
 //clock working mode definitions
 #define SHOWNODIGIT		0x01
 #define SHOWCLOCK			0x02
@@ -84,13 +125,13 @@
 #define SETAL				0x12
 #define SETSECMODE		0x13
 #define SETDIMMODE		0x14
+#define SETREFRESH		0x15
 
-//store parameter values
-#define	STORE_USMODE	0x01
-#define	STORE_SWING		0x02
-#define	STORE_SECMODE	0x04
-#define	STORE_DIMMODE	0x08
-#define	STORE_ALL		0x0F
+//settings record in EEPROM
+#define SETTINGSVERSION	2					// change if the settings record changes
+#define SETTINGSSLOTS	32					// records in the EEPROM log
+
+#define HOTMAGIC		0xA5				// marks valid hot state in the DS1302 RAM
 
 //Default values for EEPROM variables if CRC is not correct.
 //Alarm default hour values should be set in the interval 0-23 even for US Mode
@@ -98,11 +139,12 @@
 #define DefSwing			1				// no swing
 #define DefUSMode			0				// no US mode
 #define DefSecMode		1
+#define DefDimMode		0
 #define DefALMinutes		30
 #define DefALHours		6				// alarm 6 o'clock default
 #define DefALSet			0				// alarm off
 
-#define EGGSTATETIME	1000
+#define EGGSTATETIME	333				// ms
 
 #define DefDiffDay		18				// difference to date (here: 18.04.2018)
 #define DefDiffMonth		4
@@ -132,17 +174,69 @@
 // store status register
 volatile uint8_t tmp_sreg;
 
+// refresh profiles: full frames (all SLOTS) per second
+// Timer1 runs in CTC mode, one compare A interrupt per slot, TOP=OCR1A from F_CPU
+#define REFRESH60		0
+#define REFRESH100		1
+#define REFRESH150		2
+#define REFRESH200		3
+#define DefRefresh		REFRESH200
+#define MaxRefresh		REFRESH200
+#define SLOTPERIOD(hz)	((F_CPU/8 + (hz)*SLOTS/2) / ((hz)*SLOTS))	// Timer1 ticks per slot, rounded
+const uint16_t slotPeriods[] PROGMEM = {SLOTPERIOD(60),SLOTPERIOD(100),SLOTPERIOD(150),SLOTPERIOD(200)};
+const uint8_t refreshRates[] PROGMEM = {60,100,150,200};	// shown in SETREFRESH
+uint8_t refreshProfile;
+volatile uint16_t slotPeriod;				// Timer1 ticks of the active profile
+
+// diagnostics of the display scan, updated once per second by refreshMeasure()
+volatile uint16_t slotCount=0;				// slots scanned since the last measure
+uint16_t refreshFps;						// achieved full frames per second
+#ifdef PROFILE_MODULE
+volatile uint32_t isrBusy=0;				// Timer1 ticks spent in the slot ISR
+uint16_t refreshLoad;						// CPU share of the slot ISR in 1/1000
+#endif
+
+// 1ms time base: Timer0 in CTC mode at clk/64, 187.5 counts per ms @12MHz -> OCR0 alternates
+// between MSOCR0 and MSOCR0+1. The slot ISR only scans, so the refresh profile is free.
+#define MSOCR0			(F_CPU/64/1000-1)
+volatile uint32_t msTicks=0;
+uint8_t ms10=0;
+volatile uint8_t ticksPending=0;			// 10ms ticks not yet seen by the scheduler
+
+// events set by the ISRs, the main loop sleeps until one of them is pending
+#define EV_TICK			0x01				// 10ms passed
+#define EV_SECOND		0x02				// a new second started
+#define EV_KEY			0x04				// key event queued by keysSample()
+#define EV_NERF			0x08				// target hit or egg timer pulse
+volatile uint8_t events=0;
+
+#ifdef PROFILE_MODULE
+//cycle budgets of the hot paths, measured with Timer1 (1 tick = 8 cycles = 0,67s @12MHz)
+//watch them in the simulator or debugger to get a baseline before changing timing,
+//"make cycles" in test/ counts the cycles of the ISRs from the AVR build
+#define PROF_ISR		0				// slot ISR, ISR(TIMER1_COMPA_vect)
+#define PROF_LOOP		1				// one pass of the main loop
+#define PROF_RTC		2				// taskRtc() incl. DS1302 read
+#define PROF_TEMP		3				// taskTemp() incl. DS18B20 read
+#define PROF_LATENCY	4				// slot ISR entry after the compare match
+#define PROF_MAX		5
+volatile uint32_t profSlots;			// Timer1 ticks of all finished slots, extends TCNT1 to ~47min
+uint32_t profBudget[PROF_MAX];			// worst case ticks
+uint16_t profLedsBudget[16];			// worst case ticks of computingLeds() per SecMode 0-15, max 43ms
+uint16_t profDisplayBudget[SETREFRESH+1];	// worst case ticks of display() per ClockMode, max 43ms
+#endif
+
 #ifdef NERFGUN_MODULE
 //nerf target detection stuff
 typedef struct
 {
-	uint16_t nerfDownTime;			//count target hits
+	uint32_t nerfHitTime;			//millis() of the last target hit, written by INT2, read with nerfHitAge()
 	uint8_t  nerfPeakTime;			//counts time between peaks
 	uint8_t  nerfPeakCount;			//count input peaks
 	uint8_t  nerfTargetCount;		//x*45ms->time target not hit
 	uint8_t  nerfState;				//state
 } nerf;
-nerf myNerf;
+volatile nerf myNerf;
 #endif
 
 //------------------------------------------------------------------------------
@@ -161,36 +255,62 @@ uint8_t Swing;
 uint8_t USMode;
 
 // EEPROM variables
-//EEMEM uint8_t ECFUnit=0;
-EEMEM uint8_t ESwing=0;
-EEMEM uint8_t EUSMode=0;
-EEMEM uint8_t ESecMode=12;
-EEMEM uint8_t EDimMode=0;
-// ECRC and DefCRC have to be recomputed manually after a modification to any of the following eeprom variables:
-// ECFUnit, ESwing, EUSMode, ESecMode
-// ECRC=ECFUnit+ESwing+EUSMode+ESecMode
-EEMEM uint8_t ECRCParams=12;
-
-// EALMinutes, EALHours, EALSet
-// ECRCALARM=EALMinutes+EALHours+EALSet
-EEMEM uint8_t EALMinutes=0;
-EEMEM uint8_t EALHours=7;
-EEMEM uint8_t EALSet=0;
-EEMEM uint8_t ECRCAlarm=7;
+// All parameters are stored together in one record. Every change appends a new record
+// to the next slot of the log (round robin), so the EEPROM wear is spread over all slots.
+// The newest record is the valid one with the highest sequence counter. The sequence is
+// written last, so a record torn by a power loss fails its CRC and the one before is used.
+typedef struct
+{
+	uint8_t sequence;				// counts the stored records
+	uint8_t version;				// SETTINGSVERSION
+	uint8_t USMode;
+	uint8_t Swing;
+	uint8_t SecMode;
+	uint8_t DimMode;
+	uint8_t ALMinutes;
+	uint8_t ALHours;
+	uint8_t ALSet;
+	uint8_t diffDate;
+	uint8_t diffMonth;
+	uint8_t diffYear;
+	uint8_t refresh;				// refresh profile REFRESH60..REFRESH200
+	uint8_t crc;					// CRC-8 of the bytes above
+} settings;
+
+// CRC-8 (Dallas/Maxim, polynomial 0x8C reflected) of the default record, computed by the compiler
+#define CRC8_BIT(c)		(((c)>>1) ^ (((c)&1) ? 0x8C : 0))
+#define CRC8_BYTE(c,b)	CRC8_BIT(CRC8_BIT(CRC8_BIT(CRC8_BIT(CRC8_BIT(CRC8_BIT(CRC8_BIT(CRC8_BIT((c)^(b)))))))))
+enum
+{
+	DEFCRC0=CRC8_BYTE(0,0),
+	DEFCRC1=CRC8_BYTE(DEFCRC0,SETTINGSVERSION),
+	DEFCRC2=CRC8_BYTE(DEFCRC1,DefUSMode),
+	DEFCRC3=CRC8_BYTE(DEFCRC2,DefSwing),
+	DEFCRC4=CRC8_BYTE(DEFCRC3,DefSecMode),
+	DEFCRC5=CRC8_BYTE(DEFCRC4,DefDimMode),
+	DEFCRC6=CRC8_BYTE(DEFCRC5,DefALMinutes),
+	DEFCRC7=CRC8_BYTE(DEFCRC6,DefALHours),
+	DEFCRC8=CRC8_BYTE(DEFCRC7,DefALSet),
+	DEFCRC9=CRC8_BYTE(DEFCRC8,DefDiffDay),
+	DEFCRC10=CRC8_BYTE(DEFCRC9,DefDiffMonth),
+	DEFCRC11=CRC8_BYTE(DEFCRC10,DefDiffYear),
+	DEFCRC12=CRC8_BYTE(DEFCRC11,DefRefresh)
+};
+#define DEFSETTINGS		{0, SETTINGSVERSION, DefUSMode, DefSwing, DefSecMode, DefDimMode, DefALMinutes, DefALHours, DefALSet, DefDiffDay, DefDiffMonth, DefDiffYear, DefRefresh, DEFCRC12}
 
-#ifdef DIFFDATE_MODULE
-EEMEM uint8_t EdiffDate=DefDiffDay;
-EEMEM uint8_t EdiffMonth=DefDiffMonth;
-EEMEM uint8_t EdiffYear=DefDiffYear;
-EEMEM uint8_t ECRCDiff = (DefDiffDay + DefDiffMonth + DefDiffYear) ;
-#endif
+const settings defaultSettings PROGMEM = DEFSETTINGS;		// used if no valid record is found
+EEMEM settings ESettings[SETTINGSSLOTS] = {DEFSETTINGS};	// the .eep file starts with a valid default record
+settings stored;					// copy of the newest record
+uint8_t storedSlot;					// slot of the newest record
 
 
 
 //global variables
-uint16_t digit, digit_addressed=0;
+uint16_t digit;
+uint8_t digit_addressed=0;
 uint8_t seconds, secondsOld;
 uint8_t d[18];
+uint8_t ledsSecond=0xFF, ledsMinute, ledsSecMode;	// state the led frame was rendered for
 dateTime dt,dt1;
 #ifdef DIFFDATE_MODULE
 dateTime diffDt;							// daytime diff days
@@ -198,19 +318,35 @@ dateTime diffDt;							// daytime diff days
 #ifdef EGGTIMER_MODULE
 dateTime eggDt;								// daytime egg timer
 uint8_t  eggState=0;
-uint16_t  eggStateTimer=0;
+uint32_t  eggHitTime=0;						// millis() of the last accepted hit, debounce
 #endif
 
 
 
 
 uint8_t temperature,tempsign=0, mySeed = 170;
-uint8_t timestamp1,timestamp2;
-uint16_t refresh=0;
-uint8_t refresh_resetted =0;
-uint8_t pulsing=0, showdigit=0, showled=0;
+uint16_t refresh=0;							// ms, restarts every second with LEDS_CASE9
+uint8_t pulsing=0, showFrame=1;
 uint8_t DimMode=0, Dim=0, dimCounter=0;
 
+#ifdef PWMDIM_MODULE
+//Dim 0..15: on-time of a multiplex slot in 1/512 of slotPeriod, gamma 2.2 -> even brightness steps
+//compare A blanks the display, compare B at slotPeriod-on-time loads the slot until the next
+//compare A. Both ISRs reach the ports after a fixed number of cycles, so the on-time does not
+//depend on how long the compare A ISR runs.
+#define DIMLEVELS		16
+const uint16_t dimOnTime[DIMLEVELS] PROGMEM = {511,443,381,324,271,224,182,144,111,83,59,40,24,13,5,3};
+uint16_t slotOnTime;					// on-time of the current Dim in Timer1 ticks
+#define DIMNIGHT		9				// auto dimming levels
+#define DIMDUSK			7
+#else
+//Dim 0..8: show one of Dim+1 frames
+#define DIMLEVELS		9
+#define DIMNIGHT		5
+#define DIMDUSK			3
+#endif
+#define DIMAUTO			DIMLEVELS		// DimMode: dim by daytime
+
 
 // display seconds working mode
 uint8_t SecMode=1;
@@ -219,7 +355,6 @@ uint8_t SecModeOld=1;
 #ifndef LEDS_SHOW_HOURMIN
 uint8_t MaxSecMode=9;
 #else
-uint8_t minutesOld=0;
 uint8_t MaxSecMode=15;
 #endif
 
@@ -234,7 +369,10 @@ uint8_t ClockMode=SHOWCLOCK;
 uint8_t ClockModeOld;
 
 //variables used for various delays
-uint16_t t1=0, t2=0, t3=0;
+uint16_t t1=0;							// ms until the display is set back
+uint8_t menu=MENU_NONE;					// MODE menu entry shown in SHOWCLOCK
+uint32_t t1Start;						// millis() when t1 was set
+uint8_t t1Armed=0;
 
 //variables used for 18X20 sensors
 #ifdef MULTI_TEMPSENSORS
@@ -315,81 +453,85 @@ uint8_t randSec()
 }
 
 
-//tool function to calculate the power of 2
-uint8_t p2(uint8_t exponent)
+#ifdef PROFILE_MODULE
+//timestamp in Timer1 ticks, TCNT1 of the current slot added to the finished slots
+uint32_t profNow(void)
 {
-	uint8_t a=1,b=1,i;
-	for(i=0;i<=exponent-1;i++)
-	{
-		b*=2;
-		a+=b;
-	}
-	return a;
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t ticks = TCNT1;
+	uint32_t slotsDone = profSlots;
+	if( (TIFR & (1<<OCF1A)) && (ticks < slotPeriod/2) )	// compare match pending but not counted yet
+	slotsDone += slotPeriod;
+	SREG = sreg;
+	return slotsDone + ticks;
 }
 
 
-//tool function to convert from decimal to binary display
-uint8_t dectobin(uint8_t number)
+//keep the ticks elapsed since start if they exceed the budget seen so far
+void profStore(uint32_t *budget, uint32_t start)
 {
-	uint8_t a,i;
-	a=1;
-	if (number==0) 	a=1;
-	else
-	for (i=0;i<number;i++) a=a*2;
-	return a;
+	uint32_t ticks = profNow() - start;
+	if(ticks > *budget)
+	*budget = ticks;
 }
 
 
-//tool function to show if an integer is odd or even
-uint8_t odd(uint8_t num)
+//the same for the 16 bit budgets, longer runs are kept as 0xFFFF
+void profStoreShort(uint16_t *budget, uint32_t start)
 {
-	return num%2;
+	uint32_t ticks = profNow() - start;
+	if(ticks > 0xFFFF)
+	ticks = 0xFFFF;
+	if(ticks > *budget)
+	*budget = ticks;
+}
+#endif
+
+
+//single led and all leds up to the given one of a led row
+const uint8_t ledBit[8] PROGMEM =
+{
+	0x01,0x02,0x04,0x08,0x10,0x20,0x40,0x80
+};
+const uint8_t ledFill[8] PROGMEM =
+{
+	0x01,0x03,0x07,0x0F,0x1F,0x3F,0x7F,0xFF
+};
+
+
+//tool function to calculate the power of 2 minus 1, all leds up to exponent
+uint8_t p2(uint8_t exponent)
+{
+	return pgm_read_byte(&ledFill[exponent & 7]);
 }
 
 
-uint8_t bb(uint8_t in11, uint8_t sec1, uint8_t sec2) //function to reduce the code
+//tool function to convert from decimal to binary display
+uint8_t dectobin(uint8_t number)
 {
-	return dectobin(seconds-in11*8)*((seconds>= sec1) && (seconds<= sec2));
+	return pgm_read_byte(&ledBit[number & 7]);
 }
 
 
-void cc(uint8_t d0,uint8_t d1,uint8_t d2,uint8_t d3,uint8_t d4,uint8_t d5,uint8_t d6,uint8_t d7, uint8_t in111)
+//tool function to show if an integer is odd or even
+uint8_t odd(uint8_t num)
 {
-	d[10]=d0 | bb(in111,0,7);
-	d[11]=d1 | bb(in111,8,15);
-	d[12]=d2 | bb(in111,16,23);
-	d[13]=d3 | bb(in111,24,31);
-	d[14]=d4 | bb(in111,32,39);
-	d[15]=d5 | bb(in111,40,47);
-	d[16]=d6 | bb(in111,48,55);
-	d[17]=d7 | bb(in111,56,59);
+	return num%2;
 }
 
 
+//light the led of 'seconds' (second or minute)
 void displayMinutes()
 {
-	uint8_t in111 = seconds/8;
-	d[10]|= bb(in111,0,7);
-	d[11]|= bb(in111,8,15);
-	d[12]|= bb(in111,16,23);
-	d[13]|= bb(in111,24,31);
-	d[14]|= bb(in111,32,39);
-	d[15]|= bb(in111,40,47);
-	d[16]|= bb(in111,48,55);
-	d[17]|= bb(in111,56,59);
+	if (seconds<60)
+	d[10+seconds/8] |= dectobin(seconds);
 }
 
 void displayMinutesInv()
 {
-	uint8_t in111 = seconds/8;
-	d[10]&= ~bb(in111,0,7);
-	d[11]&= ~bb(in111,8,15);
-	d[12]&= ~bb(in111,16,23);
-	d[13]&= ~bb(in111,24,31);
-	d[14]&= ~bb(in111,32,39);
-	d[15]&= ~bb(in111,40,47);
-	d[16]&= ~bb(in111,48,55);
-	d[17]&= ~bb(in111,56,59);
+	if (seconds<60)
+	d[10+seconds/8] &= ~dectobin(seconds);
 }
 
 
@@ -548,7 +690,7 @@ void DisplayHours(uint8_t i, uint8_t j)
 
 void growingCycle (uint8_t seconds)
 {
-	uint8_t j=refresh/19;						// /13 for 8MHz, /19 for 12MHz
+	uint8_t j=refresh/6;						// one more led every 6ms
 	if (j<=seconds)
 	{
 		uint8_t in1 = j/8;
@@ -564,22 +706,21 @@ void growingCycle (uint8_t seconds)
 	}
 }
 
-void redLedsOn (uint8_t in1)
+//red (hour) leds of one led row, the pattern repeats every 5 rows
+const uint8_t redLeds[5] PROGMEM =
 {
-	cc(0b00100001,0b10000100,0b00010000,0b01000010,0b00001000,0b00100001,0b10000100,0b00010000,in1);	// 1, 2, 5
-}
+	0b00100001,0b10000100,0b00010000,0b01000010,0b00001000
+};
 
 
 void redLedsAllOn ()
 {
-	d[10]=0b00100001;
-	d[11]=0b10000100;
-	d[12]=0b00010000;
-	d[13]=0b01000010;
-	d[14]=0b00001000;
-	d[15]=0b00100001;
-	d[16]=0b10000100;
-	d[17]=0b00010000;
+	uint8_t i, j=0;
+	for (i=10;i<18;i++)
+	{
+		d[i]=pgm_read_byte(&redLeds[j]);
+		if (++j>4) j=0;
+	}
 }
 
 
@@ -589,7 +730,7 @@ void setRedLed(uint8_t hour, uint8_t set)
 	hour-=12;
 
 	uint8_t arrayPos = 10+((hour*5)/8);
-	uint8_t arrayValue =  (1<<(((hour*5)%8)));
+	uint8_t arrayValue =  dectobin(hour*5);
 
 	if(!set)
 	{
@@ -604,78 +745,105 @@ void setRedLed(uint8_t hour, uint8_t set)
 
 }
 
-//led function
-void computingLeds(void)
+//led pattern descriptor bits
+#define LP_FILL			0x01			// light all seconds up to the current one, else only the current
+#define LP_INVERT		0x02			// invert the whole frame
+#define LP_SWING		0x04			// invert the whole frame at even minutes
+#define LP_RED			0x08			// red (hour) leds lit
+#define LP_REDSHIFT		0x10			// red leds lit, shift when the current second falls on them
+#define LP_REDGAP		0x18			// red leds lit, off when the current second falls on them
+#define LP_REDMASK		0x18
+#define LP_RANDOM		0x20			// random seconds
+#define LP_ODD			0x40			// random seconds at odd seconds only
+#define LP_CUSTOM		0x80			// no descriptor, computed in computingLeds()
+
+//led pattern of every SecMode, a new mode is just a new descriptor
+const uint8_t ledPattern[16] PROGMEM =
 {
-	//computing seconds -> multiple choices available pertaining to the design we wish
-	if( (SecMode==14) ||  ((SecMode==15) && odd(seconds)) )
-	{
-		seconds=randSec();
-	}
-	if( (SecMode==0) ||  (SecMode==10) ||  (SecMode==99) )
-	{
-		//d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]=0b00000000;	// set all ni
-		d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]=0;			// set all off
-	}
+	LP_CUSTOM,							// 0: don't show any led
+	0,									// 1: seconds go normally
+	LP_INVERT,							// 2: seconds are all lit except the current one
+	LP_FILL,							// 3: seconds fill progressively
+	LP_FILL|LP_INVERT,					// 4: seconds empty progressively
+	LP_FILL|LP_SWING,					// 5: fill at odd minutes and empty at even minutes
+	LP_RED,								// 6: seconds go normally and red leds lit
+	LP_REDSHIFT,						// 7: red leds shift when the current second falls on them
+	LP_REDGAP,							// 8: red leds go off when the current second falls on them
+	LP_CUSTOM,							// 9: growing cycle
+	LP_CUSTOM,							// 10-13: hour and minute
+	LP_CUSTOM,
+	LP_CUSTOM,
+	LP_CUSTOM,
+	LP_RANDOM,							// 14: led's randomly
+	LP_RANDOM|LP_ODD					// 15: led's randomly at odd seconds
+};
 
-	uint8_t i;
-	uint8_t in1=seconds/8;
-	uint8_t seconds2=seconds-in1*8;
 
-	switch(SecMode)
-	{
-		case 0: // don't show any led
-		//[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]=0b00000000;	// set all ni
-		break;
+//interpret one led pattern descriptor into d[10..17]
+void patternLeds(uint8_t pattern)
+{
+	uint8_t i, value, mask, row, invert, red, j=0;
 
-		case 1: //seconds go normally
-		SetFill(in1,0x00,dectobin(seconds2),0x00);
-		break;
+	if( (pattern & LP_RANDOM) && (!(pattern & LP_ODD) || odd(seconds)) )
+	seconds=randSec();
 
-		case 2: //seconds are all lit except the current one
-		SetFill(in1,0xFF,~dectobin(seconds2),0xFF);
-		break;
+	row=seconds/8;
+	if (pattern & LP_FILL)
+	mask=p2(seconds);
+	else
+	mask=dectobin(seconds);
 
-		case 3: //seconds fill progressively
-		for (i=0;i<in1;i++)
-		SetFill(in1,0xFF,p2(seconds2),0x00);
-		break;
+	red=pattern & LP_REDMASK;
+	if( (red > LP_RED) && (seconds%5 == 0) )
+	{
+		if (red == LP_REDGAP)
+		red=0;
+		else
+		j=odd(seconds/5) ? 3 : 2;				// start the red pattern shifted
+	}
 
-		case 4:	//seconds empty progressively
-		SetFill(in1,0x00,~p2(seconds2),0xFF);
-		break;
+	invert=(pattern & LP_INVERT) || ((pattern & LP_SWING) && !odd(dt.minute));
 
-		case 5://seconds fill progressively at odd minutes and empty progressively at even minutes
-		if (odd(dt.minute))
-		{
-			SetFill(in1,0xFF,p2(seconds2),0x00);
-		}
+	for (i=0;i<8;i++)
+	{
+		if (i<row)
+		value=(pattern & LP_FILL) ? 0xFF : 0x00;
+		else if (i==row)
+		value=mask;
 		else
-		{
-			SetFill(in1,0x00,~p2(seconds2),0xFF);
-		}
-		break;
+		value=0x00;
 
-		case 6: //seconds go normally and red leds lit
-		redLedsOn(in1);
-		break;
+		if (red)
+		value|=pgm_read_byte(&redLeds[j]);
+		if (++j>4) j=0;
 
-		case 7:	//seconds go normally and red leds lit. Red leds shift when the current second falls on them
-		if (seconds%5 != 0)
-		redLedsOn(in1);
-		else if (odd(seconds/5))
-		cc(0b01000010,0b00001000,0b00100001,0b10000100,0b00010000,0b01000010,0b00001000,0b00100001,in1);
-		else
-		cc(0b00010000,0b01000010,0b00001000,0b00100001,0b10000100,0b00010000,0b01000010,0b00001000,in1);
-		break;
+		if (invert)
+		value=~value;
+		d[i+10]=value;
+	}
+}
 
-		case 8:	//seconds go normally and red leds lit. Red leds go off when the current second falls on them
-		if (seconds%5 != 0)
-		redLedsOn(in1);
-		else
-		cc(0,0,0,0,0,0,0,0,in1);
-		break;
 
+//led function
+void computingLeds(void)
+{
+	uint8_t pattern=LP_CUSTOM;
+
+	if (SecMode < sizeof(ledPattern))
+	pattern=pgm_read_byte(&ledPattern[SecMode]);
+	if (!(pattern & LP_CUSTOM))
+	{
+		patternLeds(pattern);
+		return;
+	}
+
+	if( (SecMode==0) ||  (SecMode==10) ||  (SecMode==99) )
+	{
+		d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]=0;			// set all off
+	}
+
+	switch(SecMode)
+	{
 		case 9:
 		#ifdef LEDS_CASE9
 		growingCycle (seconds);
@@ -686,21 +854,14 @@ void computingLeds(void)
 		// show hour and minute with leds:
 		case 10:
 		seconds = dt.minute;
-		if( (minutesOld!=seconds) || (SETSECMODE==ClockMode) )		// do only if minutes changed
+		setRedLed(dt.hour, 1);											// red led (hour on)
+		if( (seconds%5) == 0 )											// don't display minutes on red leds (red leds only for hours)
 		{
-			minutesOld=seconds;
-			cli();
-			//d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]=0;			// set all off
-			setRedLed(dt.hour, 1);										// red led (hour on)
-			sei();
-			if( (seconds%5) == 0.0 )									// don't display minutes on red leds (red leds only for hours)
-			{
-				seconds--;												// displayMinutes twice then
-				displayMinutes();
-				seconds +=2;
-			}
+			seconds--;													// displayMinutes twice then
 			displayMinutes();
+			seconds +=2;
 		}
+		displayMinutes();
 		break;
 
 		case 11:															// show hour and minute with flashing leds
@@ -718,9 +879,7 @@ void computingLeds(void)
 		}
 		else
 		{
-			cli();
 			setRedLed(dt.hour, 0);										// red led (hour) off
-			sei();
 		}
 		break;
 		
@@ -730,9 +889,7 @@ void computingLeds(void)
 		if ( odd(seconds) )												// 'blinking'
 		{
 			seconds =  dt.minute;										// set minute(s)
-			cli();
 			setRedLed(dt.hour, 0);										// red led (hour) off
-			sei();
 
 			if(seconds)
 			seconds--;
@@ -746,9 +903,7 @@ void computingLeds(void)
 
 				if(seconds%5) 											// don't display minutes on red leds (red leds only for hours)
 				{
-					cli();
 					displayMinutesInv();
-					sei();
 				}
 			}
 		}
@@ -758,21 +913,14 @@ void computingLeds(void)
 		if ( odd(seconds) )												// 'blinking'
 		{
 			seconds =  dt.minute;
-			cli();
-			redLedsOn(seconds/8);
+			patternLeds(LP_RED);										// minute and red leds
 			setRedLed(dt.hour, 0);										// red led (hour off)
-			sei();
 		}
 		else
 		redLedsAllOn();
 
 		break;
 
-		case 14: // led's randomly
-		case 15:
-		SetFill(in1,0x00,dectobin(seconds2),0x00);
-		break;
-
 		#endif
 		#ifdef NERFGUN_MODULE
 		case 99:															// a nerf hit has count
@@ -788,6 +936,23 @@ void computingLeds(void)
 }
 
 
+//render the leds only if second, minute or led mode changed since the last frame,
+//then copy the frame in one go into the buffer scanned by the ISR
+void renderLeds(void)
+{
+	#ifdef LEDS_CASE9
+	if(SecMode!=9)												// growing cycle is animated within the second
+	#endif
+	if( (seconds==ledsSecond) && (dt.minute==ledsMinute) && (SecMode==ledsSecMode) )
+	return;
+
+	ledsSecond=seconds;
+	ledsMinute=dt.minute;
+	ledsSecMode=SecMode;
+	computingLeds();
+}
+
+
 void computingSomeDigits(uint8_t digit)
 {
 	uint8_t	d1= digit/10;
@@ -829,12 +994,148 @@ void computingSomeDigits(uint8_t digit)
 
 }
 
+//port images of one multiplex slot, prepared by buildSlots()
+typedef struct
+{
+	uint8_t a;							// segments / led data, low active
+	uint8_t c;							// led row select, low active
+	uint8_t d;							// digit select, low active, keeps TX, RX and the pullups of PLUS, MODE
+} slotImage;
+slotImage slotTables[2][SLOTS];			// the table scanned by the ISR and the one buildSlots() fills
+slotImage * volatile slots = slotTables[0];	// scanned table: 0-3 digits, 4-11 led rows
+#ifdef PWMDIM_MODULE
+slotImage * volatile slotLit = slotTables[0];	// slot started by compare A, loaded by compare B
+#endif
+uint8_t slotVisits[SLOTS];				// slots per frame of digit 0-3 and led row 0-7
+uint16_t slotDuty[SLOTS];				// on-time of digit 0-3 and led row 0-7 in 1/1000, see refreshMeasure()
+
+#ifdef PWMDIM_MODULE
+//on-time of the slots for Dim in the active refresh profile, compare B loads the slot
+//slotOnTime ticks before the next compare A. Dim 0 is loaded by compare A itself.
+void setOnTime(void)
+{
+	uint8_t sreg = SREG;
+	uint16_t period = slotPeriod;
+
+	slotOnTime = period;
+	if(Dim)
+	slotOnTime = ((uint32_t)period * pgm_read_word(&dimOnTime[Dim])) >> 9;
+
+	cli();
+	if(slotOnTime < period)
+	{
+		OCR1B = period - 1 - slotOnTime;			// compare A comes at period-1
+		TIMSK |= (1<<OCIE1B);
+	}
+	else
+	TIMSK &= ~(1<<OCIE1B);							// full brightness, no compare interrupt
+	SREG = sreg;
+}
+#endif
+
+#ifdef SKIP_EMPTY_ROWS
+//most led rows lit at once in SecMode 0-15 over a day, checked against computingLeds() by the host test
+const uint8_t ledRowsWorst[16] PROGMEM = {0,1,8,8,8,8,8,8,8,8,3,8,8,8,1,1};
+#endif
+
+//prepare the port images of all slots from d[] in the unused table and swap it in, called by display()
+//with SKIP_EMPTY_ROWS the slots the led rows of the SecMode never need show the digits once more,
+//so digits and rows keep a fixed on-time within the SecMode, whatever the seconds light up
+void buildSlots(void)
+{
+	uint8_t i, j, n=0, sreg, passes=1;
+	uint8_t showdigit=1;
+	slotImage *next;
+
+	sreg = SREG;
+	cli();
+	if ( (pulsing) && (refresh>=175) )	// pulsing for SET modes
+	showdigit=0;
+	SREG = sreg;
+	if (ClockMode == SHOWNODIGIT)
+	showdigit=0;						// do not show digits
+
+	#ifdef SKIP_EMPTY_ROWS
+	uint8_t rowSlots=8;
+	if (SecMode<16)
+	rowSlots = pgm_read_byte(&ledRowsWorst[SecMode]);
+	passes = (SLOTS-rowSlots)/4;
+	rowSlots = SLOTS-4*passes;			// the slots left over by the digits
+	#endif
+
+	next = (slots == slotTables[0]) ? slotTables[1] : slotTables[0];
+	for (j=0;j<passes;j++)
+	{
+		for (i=0;i<4;i++)
+		{
+			next[n].a = showdigit ? ~d[i] : ~(SEG_NULL);
+			next[n].c = 0xFF;							// deselect all led rows
+			next[n].d = 0xFC & ~(1<<(i+4));				// select digit i
+			n++;
+		}
+		if (j)
+		continue;
+		for (i=0;i<8;i++)								// the led rows after the first pass
+		{
+			#ifdef SKIP_EMPTY_ROWS
+			slotVisits[i+4] = ( (d[i+10] != 0) && (rowSlots) );
+			if (!slotVisits[i+4])
+			continue;									// dark row
+			rowSlots--;
+			#endif
+			next[n].a = ~d[i+10];						// leds, d[10..17]
+			next[n].c = ~(1<<i);						// select led row i
+			next[n].d = 0xFC;							// deselect all digits
+			n++;
+		}
+	}
+	for (i=0;i<4;i++)
+	slotVisits[i] = passes;
+	for (;n<SLOTS;n++)
+	{
+		next[n].a = 0xFF;								// idle slot, display stays blank
+		next[n].c = 0xFF;
+		next[n].d = 0xFC;
+	}
+
+	cli();
+	slots = next;										// the ISR sees either table complete
+	SREG = sreg;
+
+	#ifdef PWMDIM_MODULE
+	setOnTime();
+	#endif
+}
+
+//blank display until the first buildSlots()
+void initSlots(void)
+{
+	uint8_t i;
+
+	for (i=0;i<SLOTS;i++)
+	{
+		slotTables[0][i].a = 0xFF;
+		slotTables[0][i].c = 0xFF;
+		slotTables[0][i].d = 0xFC;
+		slotVisits[i] = 1;
+	}
+	#ifdef ASM_MULTIPLEX
+	__asm__ __volatile__ ("clr r2\n\tclr r3");					// slot and frame of multiplex.S
+	#endif
+}
+
+
+
 //main display function
 void display(void)
 {
 	uint8_t hr, min, month, date, temp;
 	uint16_t year;
 	uint8_t temphr,tempmin;
+	#ifdef PROFILE_MODULE
+	uint32_t profStart = profNow();
+	uint8_t profMode = ClockMode;
+	#endif
 
 	if (ClockMode==SHOWSENSORS)
 	{
@@ -844,7 +1145,7 @@ void display(void)
 	if (ClockMode==SHOWCLOCK)
 	{
 		//digit=refresh/13;
-		if (t2==0)//show clock
+		if (menu==MENU_NONE)//show clock
 		{
 			if (USMode)
 			{	//1-12 only in us mode
@@ -863,32 +1164,37 @@ void display(void)
 			if (hr>9) d[0]= seg[d[4]]; else d[0]= SEG_NULL;
 			d[1]= seg[d[5]];
 			//add dot point on odd seconds
-			if (refresh<512) d[1]+=SEG_dot;
+			if (refresh<175) d[1]+=SEG_dot;
 			d[2]= seg[d[6]];
 			d[3]= seg[d[7]];
 		}
 		else
-		if (t2<5) //show "date" while setting the clock
+		if (menu==MENU_DATE) //show "date" while MODE is held
 		{
 			SetD(seg[18],seg[17],seg[19],seg[21]);
 		}
 		else
-		if (t2<10)  //show "S :AL" (Set Alarm) while setting the clock
+		if (menu==MENU_ALARM)  //show "S :AL" (Set Alarm)
 		{
 			SetD(seg[5],seg[10],seg[17],seg[20]);
 		}
 		else
-		if (t2<=15) //show  "LED"              "diff"  dim
+		if (menu==MENU_SECMODE) //show  "LED"              "diff"  dim
 		{
 			//SetD(seg[18],seg[24],seg[14],seg[14]);
 			SetD(seg[20],seg[21],seg[18],seg[16]);
 		}
 		else
-		if (t2<=20) //show  "dim"
+		if (menu==MENU_DIM) //show  "dim"
 		{
 			SetD(seg[18],seg[24],seg[13],seg[13]);
 		}
-		else		//show "S :CL" (Set clock) while setting the clock
+		else
+		if (menu==MENU_REFRESH) //show  " FPS"
+		{
+			SetD(seg[16],seg[14],seg[22],seg[26]);
+		}
+		else		//show "S :CL" (Set clock)
 		{
 			SetD(seg[5],seg[10],seg[12],seg[20]);
 		}
@@ -1034,32 +1340,38 @@ void display(void)
 	else
 	if (ClockMode==SETDIMMODE)
 	{
-		d[7]=DimMode;
-		SetD(seg[16],seg[16],seg[16],seg[d[7]]);
+		if (DimMode==DIMAUTO)
+		{
+			SetD(seg[16],seg[16],seg[16],seg[17]);	// "A"
+		}
+		else
+		{
+			SetTwoDigit(DimMode, 6,7);
+			SetD(seg[16],seg[16],(DimMode>9)?seg[d[6]]:SEG_NULL,seg[d[7]]);
+		}
 	}
-	computingLeds();
-}
-
-
-
-//function that beeps
-void beep(void)
-{
-	PORTB &= ~_BV(4);
-	_delay_ms(150);
-	PORTB |= _BV(4);
-	_delay_ms(150);
+	else
+	if (ClockMode==SETREFRESH)
+	{
+		temp=pgm_read_byte(&refreshRates[refreshProfile]);	// frames per second
+		SetTwoDigit(temp%100, 6,7);
+		SetD(seg[16],(temp>99)?seg[temp/100]:SEG_NULL,seg[d[6]],seg[d[7]]);
+	}
+	#ifdef PROFILE_MODULE
+	if(profMode <= SETREFRESH)
+	profStoreShort(&profDisplayBudget[profMode], profStart);
+	profStart = profNow();
+	profMode = SecMode;
+	#endif
+	renderLeds();
+	#ifdef PROFILE_MODULE
+	if(profMode < 16)
+	profStoreShort(&profLedsBudget[profMode], profStart);
+	#endif
+	buildSlots();
 }
 
 
-////function that beeps for x ms
-//void beepMS(uint16_t ms)
-//{
-//uint16_t i = ms/10;
-//while(i--)
-//beep();
-//}
-
 
 #ifdef MULTI_TEMPSENSORS
 uint8_t Search_sensors(void)
@@ -1099,27 +1411,20 @@ uint8_t Search_sensors(void)
 
 
 
-//function which reads if there is any key pressed
+//function which reads if there is any key pressed (not debounced)
 uint8_t readkeys(void)
 {
-	uint16_t keypressed=0;
+	uint8_t keypressed=0;
 
-	////SELECT and SET keys simultaneously. Not used.
-	//if (bit_is_clear(KPIN, KEYSELECT) && bit_is_clear(KPIN, KEYSET))
-	//{
-	//keypressed=3;
-	//}
-	////SELECT key
-	//else
+	//SELECT key
 	if bit_is_clear(KPIN, KEYSELECT)
 	{
-		keypressed=1;
+		keypressed|=KEY_PLUS;
 	}
 	//SET key
-	else
 	if bit_is_clear(KPIN, KEYSET)
 	{
-		keypressed=2;
+		keypressed|=KEY_MODE;
 	}
 	
 	return keypressed;
@@ -1127,6 +1432,77 @@ uint8_t readkeys(void)
 }
 
 
+uint8_t keyQueue[KEYQUEUE];
+volatile uint8_t keyHead=0, keyTail=0;
+uint8_t keyRaw=0, keyStable=0, keyHeld, keyRepeat, keyLong;
+volatile uint8_t keysDown=0;			// debounced keys held
+volatile uint8_t keyAccel=0;			// PLUS sets a numeric field -> accelerate its repeats
+
+//queue a key event for taskKeys(), dropped if the queue is full
+void keyEvent(uint8_t event)
+{
+	uint8_t next=(keyHead+1) & (KEYQUEUE-1);
+	if(next!=keyTail)
+	{
+		keyQueue[keyHead]=event;
+		keyHead=next;
+		events|=EV_KEY;
+	}
+}
+
+//debounce the keys and generate press, release, long and repeat events, every 10ms from the Timer0 ISR
+void keysSample(void)
+{
+	uint8_t raw=readkeys();
+
+	if(raw!=keyRaw)								// still bouncing
+	{
+		keyRaw=raw;
+		keyStable=0;
+	}
+	else if( (keyStable<KEYDEBOUNCE) && (++keyStable==KEYDEBOUNCE) )
+	{
+		if(raw & ~keysDown)						// a key was added -> press, KEY_BOTH if both
+		{
+			keysDown=raw;
+			keyHeld=0;
+			keyRepeat=KEYREPEATDELAY;
+			keyLong=KEYLONG;
+			keyEvent(KEV_PRESS|raw);
+		}
+		else if( (!raw) && (keysDown) )			// all keys released, one of two released is ignored
+		{
+			keyEvent(KEV_RELEASE|keysDown);
+			keysDown=0;
+		}
+	}
+
+	if(keysDown)
+	{
+		if(keyHeld<255)
+		keyHeld++;
+		if(--keyLong==0)
+		{
+			keyLong=KEYLONG;
+			keyEvent(KEV_LONG|keysDown);
+		}
+		if(--keyRepeat==0)
+		{
+			uint8_t event=KEV_REPEAT|keysDown;
+			keyRepeat=KEYREPEAT;
+			if( (keyAccel) && (keysDown==KEY_PLUS) )
+			{
+				if(keyHeld>=KEYJUMP)
+				event|=KEV_JUMP;
+				else if(keyHeld>=KEYFAST)
+				keyRepeat=KEYREPEATFAST;
+			}
+			keyEvent(event);
+		}
+	}
+}
+
+
 uint8_t ConvertCToF(uint8_t cdigit)
 {
 	if (cdigit>100)
@@ -1134,6 +1510,8 @@ uint8_t ConvertCToF(uint8_t cdigit)
 		if (USMode == 1)
 		{
 			tempsign=(cdigit<110);						// negative F temperatures come below -17C
+			if (tempsign)
+			return (128-cdigit)*9/5-32;					// shown after a minus sign
 			return 32-(128-cdigit)*9/5;
 		}
 		else
@@ -1153,160 +1531,193 @@ uint8_t ConvertCToF(uint8_t cdigit)
 
 void SetParams(uint8_t tpulsing)
 {
-	pulsing=tpulsing;
-	dt=get_date_time();
-	seconds=dt.second;
-	_delay_ms(10);
+	pulsing=tpulsing;							// dt is read by taskRtc()
 }
 
 
-void SetPortA (uint8_t i)
+//select a refresh profile REFRESH60..REFRESH200, the ms time base does not change
+//the dimmed on-time follows the new slot period
+void setRefresh(uint8_t profile)
 {
-	PORTC=0xFF;							// deselect all led rows
-	PORTD = (0xFC & (~(1<<(i+4))));		// set digits -> set PORTD but not TX, RX, PLUS, MODE
-
-	if (showdigit)
-	PORTA = ~(d[i]);
-	else
-	PORTA= ~(SEG_NULL);
-};
+	uint16_t period = pgm_read_word(&slotPeriods[profile]);
+	uint8_t sreg = SREG;
+
+	cli();
+	refreshProfile = profile;
+	slotPeriod = period;
+	OCR1A = period - 1;										// not buffered in CTC mode
+	if(TCNT1 >= period - 1)
+	TCNT1 = 0;												// would count up to 0xFFFF otherwise
+	SREG = sreg;
+	#ifdef PWMDIM_MODULE
+	setOnTime();
+	#endif
+}
 
 
-void SetPortACD(uint8_t i, uint8_t j)
+//frames/s and CPU share of the slot ISR since the last call and the duty per slot, called once per second
+void refreshMeasure(void)
 {
-	PORTD= 0xFC;			// set nil to digits -> set PORTD all high but not TX, RX, PLUS, MODE
-	if(showled)
-	{
-		PORTC=j;				// Select Bit0 - first 8 leds
-		//_delay_us(10);
-		PORTA = ~(d[i]);	// set led data to display
-	}
-	else
-	{
-		PORTA=0xFF;			// Led data is nil
-		PORTC=0xFF;			// deselect all led rows
-	}
-};
+	uint16_t slotsDone;
+	#ifdef PROFILE_MODULE
+	uint32_t busy;
+	#endif
 
+	cli();
+	slotsDone = slotCount;
+	slotCount = 0;
+	#ifdef PROFILE_MODULE
+	busy = isrBusy;
+	isrBusy = 0;
+	#endif
+	sei();
 
+	refreshFps = slotsDone / SLOTS;
+	#ifdef PROFILE_MODULE
+	refreshLoad = busy / (F_CPU/8/1000);					// share of the Timer1 ticks in one second
+	#endif
 
-//interrupt routine for character and seconds display into an unending loop.
-//it uses the second 16-bit timer, TIMER1 ~> every 666s
-ISR(TIMER1_OVF_vect)
-{
-	tmp_sreg = SREG;																		// store status register
+	//duty of each digit and led row: its slots per frame, shortened by dimming
+	#ifdef PWMDIM_MODULE
+	uint16_t onTime = ((uint32_t)slotOnTime << 9) / slotPeriod;
+	#else
+	uint16_t onTime = 512/(Dim+1);							// one of Dim+1 frames shown
+	#endif
+	uint8_t i;
+	for (i=0;i<SLOTS;i++)
+	slotDuty[i] = ((uint32_t)slotVisits[i] * onTime * 1000) / (SLOTS*512UL);
+}
 
+
+//one ms passed, called by the Timer0 ISR
+void msTick(void)
+{
+	msTicks++;
 	refresh++;
-	#ifdef LEDS_CASE9
-	//comment up to the next sign in order to use first version of function for seconds #6
-	//	|
-	//	v
-	timestamp1=dt.second;
-	if (timestamp1==timestamp2)
-	{
-		if (!refresh_resetted)
-		{
-			refresh=0;
-			refresh_resetted=1;
-		}
-	}
-	else
+
+	#ifdef NERFGUN_MODULE
+	if(myNerf.nerfPeakCount)
 	{
-		refresh_resetted=0;
+		if(myNerf.nerfPeakTime>2)								// detect peaks in an interval of 2ms,
+		myNerf.nerfPeakCount=0;								// after that reset nerf peak counter
+		else
+		myNerf.nerfPeakTime++;
 	}
-	//	^
-	//	|
-	//comment from the first sign in order to use first version of function for seconds #6
 	#endif
-	
-	if(digit_addressed < 4)
+
+	if(rtc_tick())
 	{
-		if (pulsing)									// pulsing for SET modes
-		showdigit=(refresh<512);
-		else
-		{
-			if(ClockMode == SHOWNODIGIT)
-			showdigit=0;							// do not show digits
-		}
-		SetPortA(digit_addressed);						// set portA for case 0-3
+		events|=EV_SECOND;
+		#ifdef LEDS_CASE9
+		refresh=0;											// growing cycle (mode 9) is animated within the second
+		#endif
 	}
-	else
+	if(++ms10 >= 10)
 	{
-		switch (digit_addressed)
-		{
-			case 4:
-			SetPortACD(10,0xFE);
-			break;
-			case 5:
-			SetPortACD(11,0xFD);
-			break;
-			case 6:
-			SetPortACD(12,0xFB);
-			break;
-			case 7:
-			SetPortACD(13,0xF7);
-			break;
-			case 8:
-			SetPortACD(14,0xEF);
-			break;
-			case 9:
-			SetPortACD(15,0xDF);
-			break;
-			case 10:
-			SetPortACD(16,0xBF);
-			break;
-			case 11:
-			SetPortACD(17,0x7F);
-			break;
-		}
+		ms10=0;
+		ticksPending++;
+		events|=EV_TICK;
+		keysSample();
+		buzzer_tick();
+	}
+}
+
+
+//1ms time base, 187 and 188 Timer0 counts in turn. Interrupts are enabled at once, so
+//the slot ISRs keep their timing while the ms work runs.
+ISR(TIMER0_COMP_vect, ISR_NOBLOCK)
+{
+	OCR0 ^= 1;												// MSOCR0 is even
+	msTick();
+}
+
+
+//ms since init(), exact on average: msTick() runs every 187 or 188 Timer0 counts
+uint32_t millis(void)
+{
+	uint8_t sreg = SREG;
+	uint32_t ms;
+
+	cli();
+	ms = msTicks;
+	SREG = sreg;
+	return ms;
+}
+
+
+//set the display back to the clock after ms, checked by taskDisplay()
+void setBackAfter(uint16_t ms)
+{
+	t1Start = millis();
+	t1 = ms;
+	t1Armed = 1;
+}
+
+
+//interrupt routine for character and seconds display into an unending loop.
+//it uses the second 16-bit timer, TIMER1 in CTC mode -> SLOTS*60..200 times per second
+//each slot only loads the port images prepared by buildSlots(), the ms work runs on Timer0
+//with ASM_MULTIPLEX the compare ISRs are the assembler versions in multiplex.S
+#ifndef ASM_MULTIPLEX
+ISR(TIMER1_COMPA_vect)
+{
+	#ifdef PROFILE_MODULE
+	uint16_t isrStart = TCNT1;								// ticks since the compare match
+	profSlots += slotPeriod;
+	if(isrStart > profBudget[PROF_LATENCY])
+	profBudget[PROF_LATENCY] = isrStart;
+	#endif
+
+	PORTC = 0xFF;											// blank before switching the data
+	PORTD = 0xFC;
+	slotImage *slot = &slots[digit_addressed];
+	#ifdef PWMDIM_MODULE
+	slotLit = slot;
+	if (!(TIMSK & (1<<OCIE1B)))								// full brightness, no compare B to load it
+	#else
+	if (showFrame)
+	#endif
+	{
+		PORTA = slot->a;
+		PORTC = slot->c;
+		PORTD = slot->d;
 	}
-	//comment the following line in order to use first version of function for seconds #9
-	//	|
-	//	v
-	timestamp2=dt.second;
-	//	^
-	//	|
 
 	digit_addressed++;
-	if(digit_addressed>=12)
+	if(digit_addressed>=SLOTS)
 	{
 		digit_addressed=0;
 
+		#ifndef PWMDIM_MODULE
 		// dim LCD display and led's
 		dimCounter++;
-		if(dimCounter > Dim)
-		{
-			dimCounter=0;
-			showdigit=1;
-			showled = 1;
-		}
-		else
-		{
-			showdigit=0;
-			showled = 0;
-		}
+		showFrame=(dimCounter > Dim);
+		if(showFrame)
+		dimCounter=0;
+		#endif
 	}
 
-	#ifdef NERFGUN_MODULE
-	if(myNerf.nerfPeakCount)
-	{
-		if(myNerf.nerfPeakTime>7)								// detect peaks in an interval of 7*IRS-TIMER1(350s),
-		myNerf.nerfPeakCount=0;								// after that reset nerf peak counter
-		else
-		myNerf.nerfPeakTime++;
-	}
-	
-	if(myNerf.nerfTargetCount)									// count downtime (time target not hit)
-	myNerf.nerfDownTime++;
-	#endif
+	slotCount++;
 
-	#ifdef EGGTIMER_MODULE
-	if(eggStateTimer>=5)
-	eggStateTimer--;
+	#ifdef PROFILE_MODULE
+	isrStart = TCNT1 - isrStart;
+	isrBusy += isrStart;
+	if(isrStart > profBudget[PROF_ISR])
+	profBudget[PROF_ISR] = isrStart;
 	#endif
+}
 
-	SREG = tmp_sreg;											// restore status register
+#ifdef PWMDIM_MODULE
+//load the slot started by compare A for the rest of the slot, the next compare A blanks it
+ISR(TIMER1_COMPB_vect)
+{
+	slotImage *slot = slotLit;
+	PORTA = slot->a;
+	PORTC = slot->c;
+	PORTD = slot->d;
 }
+#endif
+#endif
 
 ////interrupt routine if MODE button pressed
 //ISR(INT0_vect)
@@ -1350,56 +1761,249 @@ int16_t diffTimeInSec (void)
 }
 #endif
 
-//function to check if the alarm should start
+//function to check if the alarm should start, sounds it for ALARMTIME getting more urgent
+#define ALARMTIME		600000UL				// ms, 10 minutes
+uint8_t alarmSecond, alarmSounding=0;
+uint32_t alarmStart;						// millis() when the alarm started
+
 void CheckAlarm(void)
 {
+	uint8_t newSecond = (alarmSecond!=dt.second);
+	alarmSecond=dt.second;
+
 	#ifdef	EGGTIMER_MODULE
 	if( (eggState) && (!diffTimeInSec()) )
 	{
 		eggState=0;
 		AlarmOn=1;
-		t3=0;
+		alarmStart=millis();
 	}
 	
 	#endif
 
 	if (ALSet)
 	{
-		if ((ALHours==dt.hour) && (ALMinutes==dt.minute) && (dt.second==0))
+		if ((ALHours==dt.hour) && (ALMinutes==dt.minute) && (dt.second==0) && (newSecond))
 		{
 			AlarmOn=1;
-			t3=0;
+			alarmStart=millis();
 		}
 	}
 
 	if (AlarmOn)
 	{
-		beep();
-		t3++;
-		if (t3==2900) AlarmOn=0; //2900=10 minutes
+		uint32_t sounding = millis()-alarmStart;
+		alarmSounding=1;
+		if(sounding > ALARMTIME)
+		AlarmOn=0;
+		else if(sounding <= 60000)
+		buzzer_loop(BEEP_ALARM1);
+		else if(sounding <= 180000)
+		buzzer_loop(BEEP_ALARM2);
+		else
+		buzzer_loop(BEEP_ALARM3);
+	}
+
+	if( (!AlarmOn) && (alarmSounding) )			// alarm timed out or stopped by key or hit
+	{
+		alarmSounding=0;
+		buzzer_stop();
 	}
 }
 
-// store clock parameter to eeprom
-void storeParameter(uint8_t parameterIndex)
+//frequently changing state, kept in the battery backed DS1302 RAM on every change.
+//The EEPROM backed parts of it are only written to EEPROM at every full hour.
+typedef struct
+{
+	uint8_t magic;					// HOTMAGIC
+	uint8_t SecMode;				// confirmed led mode
+	uint8_t DimMode;
+	uint8_t refresh;				// refresh profile
+	uint8_t ClockMode;				// last show mode
+	uint8_t nerfTargetCount;
+	uint8_t eggHour;				// egg timer target
+	uint8_t eggMinute;
+	uint8_t check;					// CRC-8 of the bytes above
+} hotState;
+hotState hot;
+uint8_t storeDirty=0;				// settings not flushed to EEPROM yet
+
+
+//CRC-8 of 4 bits (polynomial 0x8C reflected), see crc8()
+const uint8_t crc8Nibble[16] PROGMEM = {0x00,0x9D,0x23,0xBE,0x46,0xDB,0x65,0xF8,0x8C,0x11,0xAF,0x32,0xCA,0x57,0xE9,0x74};
+
+//CRC-8 (Dallas/Maxim, as on the 1-Wire bus), two table lookups per byte
+uint8_t crc8(const uint8_t *data, uint8_t length)
 {
-	if(parameterIndex & STORE_USMODE)
+	uint8_t crc=0;
+	while(length--)
 	{
-		eeprom_write_byte(&EUSMode,USMode);
+		crc^=*data++;
+		crc=(crc>>4) ^ pgm_read_byte(&crc8Nibble[crc&0x0F]);
+		crc=(crc>>4) ^ pgm_read_byte(&crc8Nibble[crc&0x0F]);
 	}
-	if(parameterIndex & STORE_SWING)
+	return crc;
+}
+
+
+// store clock parameters to eeprom: append a record if anything changed
+void storeSettings(void)
+{
+	settings now;
+
+	now.version=SETTINGSVERSION;
+	now.USMode=USMode;
+	now.Swing=Swing;
+	now.SecMode=SecModeOld;
+	now.DimMode=DimMode;
+	now.ALMinutes=ALMinutes;
+	now.ALHours=ALHours;
+	now.ALSet=ALSet;
+	#ifdef DIFFDATE_MODULE
+	now.diffDate=diffDt.date;
+	now.diffMonth=diffDt.month;
+	now.diffYear=diffDt.year;
+	#else
+	now.diffDate=DefDiffDay;
+	now.diffMonth=DefDiffMonth;
+	now.diffYear=DefDiffYear;
+	#endif
+	now.refresh=refreshProfile;
+	if (memcmp(&now.version, &stored.version, sizeof(settings)-2) == 0)
+	return;
+
+	now.sequence=stored.sequence+1;
+	now.crc=crc8((uint8_t *)&now, sizeof(settings)-1);
+	if (++storedSlot>=SETTINGSSLOTS)
+	storedSlot=0;
+	ee_queue_block(&now.version, &ESettings[storedSlot].version, sizeof(settings)-1);	// written in the background, changed bytes only
+	ee_queue_byte(&ESettings[storedSlot].sequence, now.sequence);		// last, completes the record
+	stored=now;
+}
+
+
+// load clock parameters from eeprom: the newest record with a valid CRC
+void loadSettings(void)
+{
+	settings record;
+	uint8_t slot, found=0;
+
+	storedSlot=SETTINGSSLOTS-1;					// no valid record: the next one goes to slot 0
+	for (slot=0;slot<SETTINGSSLOTS;slot++)
 	{
-		eeprom_write_byte(&ESwing,Swing);
+		eeprom_read_block(&record, &ESettings[slot], sizeof(settings));
+		if( (record.version!=SETTINGSVERSION) || (record.crc!=crc8((uint8_t *)&record, sizeof(settings)-1)) )
+		continue;								// torn, old version or never written
+
+		//the valid records span at most SETTINGSSLOTS sequence numbers, so the difference orders them
+		if( (!found) || ((int8_t)(record.sequence-stored.sequence) > 0) )
+		{
+			stored=record;
+			storedSlot=slot;
+			found=1;
+		}
 	}
-	if(parameterIndex & STORE_SECMODE)
+
+	if (!found)
 	{
-		eeprom_write_byte(&ESecMode,SecMode);
+		//no valid record in EEPROM =>
+		//use the default values, they are written with the next change only
+		memcpy_P(&stored, &defaultSettings, sizeof(settings));
 	}
-	if(parameterIndex & STORE_DIMMODE)
+
+	//CFUnit=DefCFUnit;
+	USMode=stored.USMode;
+	Swing=stored.Swing;
+	SecMode=SecModeOld=stored.SecMode;
+	DimMode=stored.DimMode;
+	ALMinutes=stored.ALMinutes;
+	ALHours=stored.ALHours;
+	ALSet=stored.ALSet;
+	#ifdef DIFFDATE_MODULE
+	diffDt.date = stored.diffDate;
+	diffDt.month = stored.diffMonth;
+	diffDt.year= stored.diffYear;
+	#endif
+	setRefresh( (stored.refresh<=MaxRefresh) ? stored.refresh : DefRefresh );
+}
+
+
+//checksum of the hot state
+uint8_t hotCheck(hotState *h)
+{
+	return crc8((uint8_t *)h, sizeof(hotState)-1);
+}
+
+
+//write the hot state to the DS1302 RAM if it changed, flush to EEPROM at every full hour
+void storeHot(void)
+{
+	hotState now, back;
+	uint8_t i;
+
+	now.magic=HOTMAGIC;
+	now.SecMode=SecModeOld;
+	now.DimMode=DimMode;
+	now.refresh=refreshProfile;
+	now.ClockMode=(ClockMode<=SHOWDIFFDAYS) ? ClockMode : hot.ClockMode;
+	#ifdef NERFGUN_MODULE
+	now.nerfTargetCount=myNerf.nerfTargetCount;
+	#else
+	now.nerfTargetCount=0;
+	#endif
+	#ifdef EGGTIMER_MODULE
+	now.eggHour=eggDt.hour;
+	now.eggMinute=eggDt.minute;
+	#else
+	now.eggHour=now.eggMinute=0;
+	#endif
+	now.check=hotCheck(&now);
+
+	for (i=0;i<sizeof(hotState);i++)
+	{
+		if (((uint8_t *)&now)[i] != ((uint8_t *)&hot)[i])
+		{
+			rtc_ram_write((uint8_t *)&now, sizeof(hotState));
+			rtc_ram_read((uint8_t *)&back, sizeof(hotState));
+			if (memcmp(&back, &now, sizeof(hotState)) == 0)
+			hot=now;						// else write protected or no DS1302, try again next second
+			break;
+		}
+	}
+
+	if( (storeDirty) && (dt.minute==0) && (dt.second==0) )
 	{
-		eeprom_write_byte(&EDimMode,DimMode);
+		storeSettings();
+		storeDirty=0;
 	}
-	eeprom_write_byte(&ECRCParams,USMode+Swing+SecMode+DimMode);
+}
+
+
+//restore the hot state from the DS1302 RAM if it is valid
+void loadHot(void)
+{
+	rtc_ram_read((uint8_t *)&hot, sizeof(hotState));
+	if( (hot.magic!=HOTMAGIC) || (hot.check!=hotCheck(&hot)) )
+	{
+		hot.magic=0;
+		return;
+	}
+
+	if( (hot.SecMode!=SecMode) || (hot.DimMode!=DimMode) || (hot.refresh!=refreshProfile) )
+	storeDirty=1;
+	SecMode=SecModeOld=hot.SecMode;
+	DimMode=hot.DimMode;
+	if (hot.refresh<=MaxRefresh)
+	setRefresh(hot.refresh);
+	if( (hot.ClockMode>=SHOWNODIGIT) && (hot.ClockMode<=SHOWDIFFDAYS) )
+	ClockMode=hot.ClockMode;
+	#ifdef NERFGUN_MODULE
+	myNerf.nerfTargetCount=hot.nerfTargetCount;
+	#endif
+	#ifdef EGGTIMER_MODULE
+	eggDt.hour=hot.eggHour;
+	eggDt.minute=hot.eggMinute;
+	#endif
 }
 
 
@@ -1424,44 +2028,70 @@ ISR(INT2_vect)
 		{
 			AlarmOn=0;
 		}
-		myNerf.nerfDownTime=0;
+		myNerf.nerfHitTime=msTicks;			// interrupts are off here
 	}
 	myNerf.nerfPeakTime=0;
 	#endif
 
+	events|=EV_NERF;						// the egg timer is handled by eggTimerHit()
 
-	#ifdef	EGGTIMER_MODULE
+	SREG = tmp_sreg;						// restore status register
+}
+
+#ifdef EGGTIMER_MODULE
+//a pulse on INT2 starts the egg timer or adds a minute, called from the main loop
+//because the egg time is taken from the clock
+void eggTimerHit(void)
+{
 	if(eggState==0)							// if not in eggtimer mode
 	{
 		if (AlarmOn)						// if alarm on
 		{
 			AlarmOn=0;							// .. set alarm off
 			ClockMode=ClockModeOld;
-			eggStateTimer=EGGSTATETIME;			// debounce: EGGSTATETIME*333-> wait  for next possible hit
+			eggHitTime=millis();				// debounce: wait EGGSTATETIME for the next possible hit
 		}
-		else if(eggStateTimer<5)
+		else if(millis()-eggHitTime >= EGGSTATETIME)
 		{
 			// start eggtimer:
 			eggState=1;
 			ClockModeOld=ClockMode;
 			ClockMode=SHOWEGGTIMER;			// set to eggtimer mode
-			eggDt =  get_date_time();		// set current date
+			t1Armed=0;						// shown until the egg timer rings
+			eggDt = dt;						// set current time, taskRtc() just ran
 			addEggTimerMin();				// add 1min to current eggtime
-			eggStateTimer=EGGSTATETIME;		// debounce: EGGSTATETIME*333-> wait  for next possible hit
+			eggHitTime=millis();			// debounce: wait EGGSTATETIME for the next possible hit
 		}
 	}
-	else if(eggStateTimer<5)
+	else if(millis()-eggHitTime >= EGGSTATETIME)
 	{
-		eggStateTimer=EGGSTATETIME;			// debounce: EGGSTATETIME*333-> wait  for next possible hit
+		eggHitTime=millis();				// debounce: wait EGGSTATETIME for the next possible hit
 		if(ClockMode==SHOWEGGTIMER)
 		addEggTimerMin();				// set eggtime + 1min
 		else
-		ClockMode=SHOWEGGTIMER;			// or set to SHOWEGGTIMER, without '+1min'
+		{
+			ClockMode=SHOWEGGTIMER;			// or set to SHOWEGGTIMER, without '+1min'
+			t1Armed=0;
+		}
 	}
-	#endif
+}
+#endif
 
-	SREG = tmp_sreg;						// restore status register
+
+#ifdef NERFGUN_MODULE
+//ms since the last target hit, nerfHitTime is written by INT2
+uint32_t nerfHitAge(void)
+{
+	uint8_t sreg = SREG;
+	uint32_t age;
+
+	cli();
+	age = msTicks - myNerf.nerfHitTime;
+	SREG = sreg;
+	return age;
 }
+#endif
+
 
 void noKeyPressed(void)
 {
@@ -1476,9 +2106,8 @@ void noKeyPressed(void)
 	{
 		#ifdef NERFGUN_MODULE										// show number of target hits if just hit
 		case SHOWNERF:
-		if(myNerf.nerfDownTime > 65500)					//~ 45sec no target hit, set back to SHOWCLOCK
+		if(nerfHitAge() > 22000)			//22sec no target hit, set back to SHOWCLOCK
 		{
-			myNerf.nerfDownTime=0;
 			myNerf.nerfTargetCount=0;
 			ClockMode=ClockModeOld;
 		}
@@ -1489,15 +2118,18 @@ void noKeyPressed(void)
 			{
 				case 1:
 				SecMode = 99;						// show red leds after hit
-				beep();
-				myNerf.nerfState=0;
-				myNerf.nerfDownTime=0;
-				myNerf.nerfState=2;
-				beep();
+				buzzer_play(BEEP_DOUBLE);
+				{
+					uint8_t sreg = SREG;
+					cli();								// INT2 must not see half of the time
+					myNerf.nerfHitTime=msTicks;
+					myNerf.nerfState=2;
+					SREG = sreg;
+				}
 				break;
 
 				case 2:
-				if(myNerf.nerfDownTime>10000)		//set led mode back after ~ 3sec
+				if(nerfHitAge() > 3400)	//set led mode back after ~ 3sec
 				{
 					SecMode = SecModeOld;
 					myNerf.nerfState=0;
@@ -1531,57 +2163,9 @@ void noKeyPressed(void)
 		break;
 
 		case SHOWCLOCK:
-		if (t2==0)
-		{
-			//show clock
-			//SetParams(0);
-			digit=dt.hour*100+dt.minute;
-		}
-		else
-		if (t2<=5)
-		{
-			//show the date
-			//SetParams(0);
-			t1=120;
-			t2=0;
-			ClockMode=SHOWDATE;
-		}
-		else
-		if (t2<=10)
-		{
-			//set the alarm
-			SetParams(1);
-			t1=900;
-			t2=0;
-			ClockMode=SETALMINUTES;
-		}
-		else
-		if (t2<=15)
-		{
-			//set sec mode
-			////set DIFFDAYS
-			//SetParams(1);
-			t1=900;
-			t2=0;
-			////digit = daysBetweenDates(dt1,dt);
-			ClockMode=SETSECMODE;
-		}
-		else
-		if (t2<=20)
-		{
-			t1=900;
-			t2=0;
-			ClockMode=SETDIMMODE;
-		}
-		else
-		{
-			//set the date
-			pulsing=1;
-			t1=900;
-			t2=0;
-			dt1=dt;
-			ClockMode=SETYEAR;
-		}
+		//show clock, the MODE menu is left by menuEnter()
+		//SetParams(0);
+		digit=dt.hour*100+dt.minute;
 		break;
 
 		case SHOWTEMP:
@@ -1596,8 +2180,7 @@ void noKeyPressed(void)
 			digit = ConvertCToF(ds18b20_getindextemp(&gSensorIDs[TEMPDISPLAY/2][0]));
 		}
 		#else
-		digit = 0;
-		digit = ConvertCToF(ds18b20_gettemp()) - TEMPCORRECTION;
+		digit = ConvertCToF(temperature) - TEMPCORRECTION;	// read by taskTemp()
 		#endif
 		//SetParams(0);
 		break;
@@ -1648,7 +2231,14 @@ void noKeyPressed(void)
 	}
 }
 
-void plusKeyPressed(void)
+//advance a numeric set field by step, wrap to min beyond max
+void stepField(uint8_t *field, uint8_t min, uint8_t max, uint8_t step)
+{
+	*field+=step;
+	if(*field>max) *field=min;
+}
+
+void plusKeyPressed(uint8_t step)
 {
 	if (AlarmOn)
 	{
@@ -1657,7 +2247,7 @@ void plusKeyPressed(void)
 	if(ClockMode>SET)
 	{
 		pulsing=0;
-		t1=900;
+		setBackAfter(9000);
 	}
 	switch (ClockMode)
 	{
@@ -1679,7 +2269,7 @@ void plusKeyPressed(void)
 
 		case SHOWTEMP:
 		#ifdef MULTI_TEMPSENSORS
-		t1=90;
+		setBackAfter(900);
 		if (++TEMPDISPLAY/2==nSensors)
 		{
 			TEMPDISPLAY=0;
@@ -1701,58 +2291,107 @@ void plusKeyPressed(void)
 		break;
 
 		case SETHOURS:
-		if (++dt1.hour>MaxHours) dt1.hour=MinHours;
+		stepField(&dt1.hour, MinHours, MaxHours, step);
 		break;
 		case SETMINUTES:
 		//pulsing=0;
-		//t1=900;
-		if (++dt1.minute>MaxMinutes) dt1.minute=MinMinutes;
+		//setBackAfter(9000);
+		stepField(&dt1.minute, MinMinutes, MaxMinutes, step);
 		break;
 		case SETDATE:
 		//pulsing=0;
-		//t1=900;
-		if (++dt1.date>MaxDate) dt1.date=MinDate;
+		//setBackAfter(9000);
+		stepField(&dt1.date, MinDate, MaxDate, step);
 		break;
 		case SETMONTH:
 		//pulsing=0;
-		//t1=900;
-		if (++dt1.month>MaxMonth) dt1.month=MinMonth;
+		//setBackAfter(9000);
+		stepField(&dt1.month, MinMonth, MaxMonth, step);
 		break;
 		case SETYEAR:
 		//pulsing=0;
-		//t1=900;
-		if (++dt1.year>MaxYears) dt1.year=MinYears;
+		//setBackAfter(9000);
+		stepField(&dt1.year, MinYears, MaxYears, step);
 		break;
 		case SETALHOURS:
 		//pulsing=0;
-		//t1=900;
-		if (++ALHours>MaxALHours) ALHours=MinALHours;
+		//setBackAfter(9000);
+		stepField(&ALHours, MinALHours, MaxALHours, step);
 		break;
 		case SETALMINUTES:
 		//pulsing=0;
-		//t1=900;
-		if (++ALMinutes>MaxALMinutes) ALMinutes=MinALMinutes;
+		//setBackAfter(9000);
+		stepField(&ALMinutes, MinALMinutes, MaxALMinutes, step);
 		break;
 		case SETAL:
 		//pulsing=0;
-		//t1=900;
+		//setBackAfter(9000);
 		if (++ALSet>MaxALSet) ALSet=MinALSet;
 		break;
 		case SETSECMODE:
 		SetParams(0);
-		//			t1=900;
+		//			setBackAfter(9000);
 		if (++SecMode>MaxSecMode) SecMode=MinSecMode;
 		break;
 		case SETDIMMODE:
-		//			t1=900;
-		if (++DimMode>9) DimMode=0;
+		//			setBackAfter(9000);
+		if (++DimMode>DIMAUTO) DimMode=0;
+		if (DimMode<DIMAUTO)
 		Dim = DimMode;
 		break;
+		case SETREFRESH:
+		setRefresh( (refreshProfile<MaxRefresh) ? refreshProfile+1 : REFRESH60 );
+		break;
 		default:
 		break;
 	}
 }
 
+//MODE released in SHOWCLOCK: enter the menu entry shown while it was held
+void menuEnter(void)
+{
+	switch (menu)
+	{
+		case MENU_DATE:
+		//show the date
+		setBackAfter(1200);
+		ClockMode=SHOWDATE;
+		break;
+
+		case MENU_ALARM:
+		//set the alarm
+		SetParams(1);
+		setBackAfter(9000);
+		ClockMode=SETALMINUTES;
+		break;
+
+		case MENU_SECMODE:
+		//set sec mode
+		setBackAfter(9000);
+		ClockMode=SETSECMODE;
+		break;
+
+		case MENU_DIM:
+		setBackAfter(9000);
+		ClockMode=SETDIMMODE;
+		break;
+
+		case MENU_REFRESH:
+		setBackAfter(9000);
+		ClockMode=SETREFRESH;
+		break;
+
+		case MENU_CLOCK:
+		//set the date
+		pulsing=1;
+		setBackAfter(9000);
+		dt1=dt;
+		ClockMode=SETYEAR;
+		break;
+	}
+	menu=MENU_NONE;
+}
+
 void modeKeyPressed(void)
 {
 	if (AlarmOn)
@@ -1766,15 +2405,12 @@ void modeKeyPressed(void)
 		case SHOWTEMP:
 		ClockMode=SHOWCLOCK;
 		case SHOWCLOCK:
-		//short key press 1-5 seconds: show date/time for 10 seconds
-		//long key press 6-10 seconds: enter alarm set
-		//more than 10 seconds pressed: enter date set
-		t2++;
-		digit=t2;
+		//MODE held steps the menu with every long press, released enters it
+		menu=MENU_DATE;
 		break;
 
 		case SHOWDATE:
-		t1=120;
+		setBackAfter(1200);
 		ClockMode=SHOWYEAR;
 		break;
 
@@ -1786,8 +2422,8 @@ void modeKeyPressed(void)
 		//write the time/date/year into the DS1302
 		pulsing=0;
 		set_date_time(dt1);
-		t1=0;
-		beep();
+		setBackAfter(0);
+		buzzer_play(BEEP_CONFIRM);
 		break;
 		case SETMINUTES:
 		ClockMode=SETHOURS;
@@ -1810,28 +2446,31 @@ void modeKeyPressed(void)
 		case SETAL:
 		//write Alarm Values into EEPROM
 		pulsing=0;
-		eeprom_write_byte(&EALHours,ALHours);
-		eeprom_write_byte(&EALMinutes,ALMinutes);
-		eeprom_write_byte(&EALSet,ALSet);
-		eeprom_write_byte(&ECRCAlarm,ALHours+ALMinutes+ALSet);
-		t1=0;
-		beep();
+		storeSettings();
+		setBackAfter(0);
+		buzzer_play(BEEP_CONFIRM);
 		break;
 		case SETSECMODE:
-		//write SecMode into EEPROM
+		//write SecMode into DS1302 RAM now, EEPROM later
 		pulsing=0;
-		storeParameter(STORE_SECMODE);
+		storeDirty=1;
 		SecModeOld = SecMode;
-		t1=0;
-		beep();
+		setBackAfter(0);
+		buzzer_play(BEEP_CONFIRM);
 		break;
 		case SETDIMMODE:
 		pulsing=0;
-		t1=0;
-		beep();
-		storeParameter(STORE_DIMMODE);
+		setBackAfter(0);
+		buzzer_play(BEEP_CONFIRM);
+		storeDirty=1;
 		//ClockMode=SHOWCLOCK;
 		break;
+		case SETREFRESH:
+		pulsing=0;
+		setBackAfter(0);
+		buzzer_play(BEEP_CONFIRM);
+		storeDirty=1;
+		break;
 		default:
 		break;
 	}
@@ -1852,13 +2491,15 @@ void init(void)
 	DDRE = 0;													// port E 0-2 as input
 
 	//Timer
-	TCNT0 = 0xFF ;												// Timer0 (is 8bit)
-	TCCR0 = 0x00;												// Timer0 stopped
-	TCNT1 = 0xFF ;												// Timer1 (is 16bit) enabled
-	TCCR1A = (1<<WGM11); 										// Timer1 enable as 9 bit PWM
-	//TCCR1B = (0<<CS12)|(1<<CS11)|(0<<CS10);						// Timer1 prescaler of clk/8
-	TCCR1B = (1<<WGM12)|(0<<CS12)|(1<<CS11)|(0<<CS10);			// Timer1 prescaler of clk/8, as 9 bit FAST PWM -> ~2,9kHz
-	TIMSK = (1<<TOIE1); 										// Timer1 overflow interrupts enabled -> at 12Mhz F_CPU/8 at 9bit*2 ~> 1,5kHz
+	buzzer_init();												// buzzer pin, played by buzzer_tick()
+	OCR0 = MSOCR0;												// Timer0 (is 8bit) is the 1ms time base
+	TCCR0 = (1<<WGM01)|(0<<CS02)|(1<<CS01)|(1<<CS00);			// Timer0 in CTC mode, prescaler of clk/64
+	TIMSK |= (1<<OCIE0);
+	TCNT1 = 0;													// Timer1 (is 16bit) enabled
+	setRefresh(DefRefresh);										// TOP of the slot, 200Hz*12 slots -> 2,4kHz
+	TCCR1A = 0; 												// Timer1 in CTC mode, TOP=OCR1A
+	TCCR1B = (1<<WGM12)|(0<<CS12)|(1<<CS11)|(0<<CS10);			// Timer1 prescaler of clk/8
+	TIMSK |= (1<<OCIE1A); 										// Timer1 compare A interrupt starts each slot
 
 	//External Interrupts
 	MCUCR |=  (1<<ISC11)| (0<<ISC10)| (1<<ISC01)| (0<<ISC00);	// The falling edge INT0+1 generates an interrupt request
@@ -1874,75 +2515,21 @@ void init(void)
 	myNerf.nerfTargetCount = 0;									// init nerf target stuff
 	myNerf.nerfPeakCount = 0;
 	myNerf.nerfState = 0;
-	myNerf.nerfDownTime = 0;
+	myNerf.nerfHitTime = 0;
 	#endif
 
-	timestamp1=timestamp2=dt.second;
-	//timestamp2=dt.second;
+	initSlots();
 
 
 
 
 	//read EEprom values to current variables
-	//CFUnit= eeprom_read_byte(&ECFUnit);
-
-	USMode= eeprom_read_byte(&EUSMode);
-	Swing= eeprom_read_byte(&ESwing);
-	SecMode= eeprom_read_byte(&ESecMode);
-	DimMode = eeprom_read_byte(&EDimMode);
-
-	uint8_t CRC = eeprom_read_byte(&ECRCParams);
-	if (CRC != (USMode+Swing+SecMode+DimMode) )
-	{
-		//CRC in EEPROM incorrect =>
-		//replace all values with default values
-		//CFUnit=DefCFUnit;
-		Swing=DefSwing;
-		USMode=DefUSMode;
-		SecMode=DefSecMode;
-		DimMode=0;
-		storeParameter(STORE_ALL);
-	}
-	SecModeOld = SecMode;
-
-	//read EEprom values alarm to current variables
-	ALMinutes= eeprom_read_byte(&EALMinutes);
-	ALHours= eeprom_read_byte(&EALHours);
-	ALSet= eeprom_read_byte(&EALSet);
-	CRC= eeprom_read_byte(&ECRCAlarm);
-	if ( CRC!=(ALMinutes+ALHours+ALSet) )
-	{
-		//CRCALARM in EEPROM incorrect =>
-		//replace all values with default values
-		ALMinutes=DefALMinutes;
-		ALHours=DefALHours;
-		ALSet=DefALSet;
-		//rewrite default values in EEPROM
-		eeprom_write_byte(&EALMinutes,ALMinutes);
-		eeprom_write_byte(&EALHours,ALHours);
-		eeprom_write_byte(&EALSet,ALSet);
-		eeprom_write_byte(&ECRCAlarm,(ALMinutes+ALHours+ALSet));
-	}
-
 	#ifdef DIFFDATE_MODULE
 	diffDt.second=0;											// set the date for calculation of 'days between dates'
 	diffDt.hour=0;
 	diffDt.minute=0;
-	diffDt.date = eeprom_read_byte(&EdiffDate);
-	diffDt.month = eeprom_read_byte(&EdiffMonth);
-	diffDt.year= eeprom_read_byte(&EdiffYear);
-	CRC = eeprom_read_byte(&ECRCDiff);
-	if ( CRC != (EdiffDate+EdiffMonth+EdiffYear) )
-	{
-		diffDt.date = DefDiffDay;
-		diffDt.month = DefDiffMonth;
-		diffDt.year= DefDiffYear;
-		eeprom_write_byte(&EdiffDate,diffDt.date);
-		eeprom_write_byte(&EdiffMonth,diffDt.month);
-		eeprom_write_byte(&EdiffYear,diffDt.year);
-		eeprom_write_byte(&ECRCDiff,(diffDt.date+diffDt.month+diffDt.year));
-	}
 	#endif
+	loadSettings();
 
 
 	#ifdef MULTI_TEMPSENSORS
@@ -1951,111 +2538,303 @@ void init(void)
 	digit=nSensors;
 	display();
 	_delay_ms(500);
-	if (nSensors==0) beep();
+	if (nSensors==0) buzzer_play(BEEP_SINGLE);
 	#else
 	ClockMode=SHOWCLOCK;
 	#endif // MULTI_TEMPSENSORS
 
+	rtc_init();													// clear the write protection before the DS1302 RAM is used
+	loadHot();													// newer values from the DS1302 RAM
+	if (DimMode>DIMAUTO)
+	DimMode=0;
+	if (DimMode<DIMAUTO)
+	Dim=DimMode;
+
 	//if only SELECT pushed on startup, toggle CFUnit and USMode.
 	if (bit_is_set(KPIN, KEYSELECT) && bit_is_clear(KPIN, KEYSET))
 	{
 		//CFUnit=!CFUnit;
 		USMode=!USMode;
 		//eeprom_write_byte(&ECFUnit,CFUnit);
-		storeParameter(STORE_USMODE);
+		storeSettings();
 	}
 
 	//if only SET pushed on startup, toggle Swing.
 	if (bit_is_clear(KPIN, KEYSELECT) && bit_is_set(KPIN, KEYSET))
 	{
 		Swing=!Swing;
-		storeParameter(STORE_SWING);
+		storeSettings();
 	}
 
+	#ifndef MULTI_TEMPSENSORS
+	ds18b20_update();											// start first temperature conversion
+	#endif
 	_delay_ms(1000);
+	#ifndef MULTI_TEMPSENSORS
+	temperature=ds18b20_update();								// first conversion done, read it
+	#endif
+	set_sleep_mode(SLEEP_MODE_IDLE);							// Timer1 and the external interrupts keep running
 	sei();			//enable interrupts
 }
 
-//main loop
-int main()
+//---------------------------------------------------------------------------------
+//tasks of the main loop, run by schedule()
+
+//read the software clock
+void taskRtc(void)
 {
-	uint8_t key;
-	init();
+	#ifdef PROFILE_MODULE
+	uint32_t profStart = profNow();
+	#endif
+	dt=rtc_now();
+	seconds=dt.second;
+	#ifdef PROFILE_MODULE
+	profStore(&profBudget[PROF_RTC], profStart);
+	#endif
+}
 
-	while(1)
+//both keys pressed together: back to the clock from the show modes
+void bothKeysPressed(void)
+{
+	if(ClockMode<SET)
 	{
-		key=readkeys();
+		menu=MENU_NONE;
+		ClockMode=SHOWCLOCK;
+	}
+}
+
+//handle the key events of the debouncer, a held key repeats every KEYREPEAT,
+//MODE held in SHOWCLOCK steps the menu every KEYLONG and enters it when released
+void taskKeys(void)
+{
+	uint8_t event;
 
-		//PLUS key was pressed
-		if (key==1)
+	while(keyTail!=keyHead)
+	{
+		event=keyQueue[keyTail];
+		keyTail=(keyTail+1) & (KEYQUEUE-1);
+		if(event & (KEV_PRESS|KEV_REPEAT))
 		{
-			plusKeyPressed();
+			//PLUS key was pressed
+			if ((event & KEY_BOTH)==KEY_PLUS)
+			{
+				plusKeyPressed((event & KEV_JUMP) ? 10 : 1);
+			}
+			//MODE key pressed, its repeats are not used by the menu
+			else if ((event & KEY_BOTH)==KEY_MODE)
+			{
+				if( (event & KEV_PRESS) || (ClockMode!=SHOWCLOCK) )
+				modeKeyPressed();
+			}
+			else if (event & KEV_PRESS)
+			{
+				bothKeysPressed();
+			}
 		}
-		//MODE key pressed
-		else if (key==2)
+		else if (event & KEV_LONG)
 		{
-			modeKeyPressed();
+			//MODE still held: next menu entry
+			if( ((event & KEY_BOTH)==KEY_MODE) && (ClockMode==SHOWCLOCK) && (menu!=MENU_NONE) && (menu<MENU_CLOCK) )
+			menu++;
 		}
-		//no key pressed
-		//if (key==0)
-		else
+		else if (event & KEV_RELEASE)
 		{
-			noKeyPressed();
+			if (ClockMode==SHOWCLOCK)
+			menuEnter();
+			menu=MENU_NONE;
 		}
-		if(key)
-		_delay_ms(250);
+	}
+
+	//no key pressed
+	if (!keysDown)
+	{
+		noKeyPressed();
+	}
+
+	//fields from SETHOURS to SETALMINUTES are numeric
+	keyAccel=( (ClockMode>=SETHOURS) && (ClockMode<=SETALMINUTES) );
+}
 
-		display();
-		CheckAlarm();
+//render digits and leds, set back the display t1 ms after setBackAfter()
+void taskDisplay(void)
+{
+	display();
 
-		//timer to set back display
-		if( (t1==0) && (ClockMode > SHOWNERF) )		// do not set back in SHOW modes
+	//timer to set back display, stays armed through the SHOW modes (e.g. a nerf hit
+	//during a SET mode) and fires once it acts
+	if( (t1Armed) && (millis()-t1Start >= t1) && (ClockMode > SHOWNERF) )
+	{
+		t1Armed=0;
+		ClockMode=SHOWCLOCK;
+		TEMPDISPLAY=0;
+	}
+}
+
+#ifndef MULTI_TEMPSENSORS
+//read the finished conversion and start the next one
+void taskTemp(void)
+{
+	#ifdef PROFILE_MODULE
+	uint32_t profStart = profNow();
+	#endif
+	temperature=ds18b20_update();
+	#ifdef PROFILE_MODULE
+	profStore(&profBudget[PROF_TEMP], profStart);
+	#endif
+}
+#endif
+
+//swing the ClockModes and dim the display by daytime
+void taskSwing(void)
+{
+	//// calc every 5 sec
+	//if( dt.second%5 == 0)
+	if( ((dt.second % 3 == 0) && (ClockMode != SHOWCLOCK)) ||
+	((dt.second % 9 == 0) && (ClockMode == SHOWCLOCK)) )
+	{
+		// swing some ClockModes (1-5)
+		if( (Swing)  && (secondsOld!=dt.second) )
 		{
-			ClockMode=SHOWCLOCK;
-			TEMPDISPLAY=0;
+			secondsOld = dt.second;
+			if(ClockMode<=SHOWDIFFDAYS)
+			{
+				ClockMode++;
+				if(ClockMode > SHOWDIFFDAYS)
+				ClockMode=SHOWCLOCK;
+			}
 		}
-		t1--;
-		
 
-		//// calc every 5 sec
-		//if( dt.second%5 == 0)
-		if( ((dt.second % 3 == 0) && (ClockMode != SHOWCLOCK)) ||
-		((dt.second % 9 == 0) && (ClockMode == SHOWCLOCK)) )
+		// dim display automaticly from 19 -> 7 o'clock
+		if(DimMode == DIMAUTO)
 		{
-			// swing some ClockModes (1-5)
-			if( (Swing)  && (secondsOld!=dt.second) )
+			if( (dt.hour > 19) || (dt.hour < 7) )
 			{
-				secondsOld = dt.second;
-				if(ClockMode<=SHOWDIFFDAYS)
-				{
-					ClockMode++;
-					if(ClockMode > SHOWDIFFDAYS)
-					ClockMode=SHOWCLOCK;
-				}
+				Dim = DIMNIGHT;
 			}
-
-			// dim display automaticly from 19 -> 7 o'clock
-			if(DimMode == 9)
+			else if(dt.hour < 9)
 			{
-				if( (dt.hour > 19) || (dt.hour < 7) )
-				{
-					Dim = 5;
-				}
-				else if(dt.hour < 9)
-				{
-					Dim = 3;
-				}
-				else if(dt.hour < 18)
-				{
-					Dim = 0;
-				}
-				else
-				{
-					Dim = 3;
-				}
+				Dim = DIMDUSK;
+			}
+			else if(dt.hour < 18)
+			{
+				Dim = 0;
+			}
+			else
+			{
+				Dim = DIMDUSK;
 			}
 		}
+	}
+}
+
 
+//cooperative scheduler: each task runs every 'period' ticks of 10ms, in table order
+typedef struct
+{
+	void (*run)(void);
+	uint8_t period;					// in 10ms ticks
+	uint8_t due;					// ticks until the next run
+	uint8_t overruns;				// runs skipped because the loop came too late
+	#ifdef PROFILE_MODULE
+	uint16_t worst;					// longest run in Timer1 ticks (0,67s)
+	#endif
+} task;
+
+#define TASK_RTC		0
+#define TASK_KEYS		1
+#define TASK_DISPLAY	2
+#define TASK_ALARM		3
+#define TASK_SWING		4
+#define TASK_TEMP		5
+
+//watch overruns (and worst with PROFILE_MODULE) in the debugger to find the task eating the budget
+task tasks[] =
+{
+	{taskRtc, 1, 1},				// TASK_RTC, before everything using dt
+	{taskKeys, 1, 1},				// TASK_KEYS
+	{taskDisplay, 1, 1},			// TASK_DISPLAY
+	{CheckAlarm, 10, 1},			// TASK_ALARM
+	{taskSwing, 10, 1},				// TASK_SWING
+	#ifndef MULTI_TEMPSENSORS
+	{taskTemp, 100, 1},				// TASK_TEMP, a conversion takes 750ms
+	#endif
+};
+#define TASKS	(sizeof(tasks)/sizeof(task))
+
+//run all tasks which became due during the last 'elapsed' ticks
+void schedule(uint8_t elapsed)
+{
+	uint8_t i;
+	task *t;
+
+	for (i=0, t=tasks; i<TASKS; i++, t++)
+	{
+		if(t->due > elapsed)
+		{
+			t->due -= elapsed;
+			continue;
+		}
+		if( (elapsed - t->due >= t->period) && (t->overruns < 255) )
+		t->overruns++;
+		t->due = t->period;
+
+		#ifdef PROFILE_MODULE
+		uint32_t profStart = profNow();
+		t->run();
+		profStoreShort(&t->worst, profStart);
+		#else
+		t->run();
+		#endif
+	}
+}
+
+
+//main loop
+int main()
+{
+	uint8_t ev, elapsed;
+	init();
+
+	while(1)
+	{
+		//sleep until an ISR reports an event, nothing changes in between
+		cli();
+		while(!events)
+		{
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+			cli();
+		}
+		ev=events;
+		events=0;
+		elapsed=ticksPending;
+		ticksPending=0;
+		sei();
+
+		#ifdef PROFILE_MODULE
+		uint32_t profStart = profNow();
+		#endif
+
+		if(ev & EV_KEY)								// handle a key press at once
+		tasks[TASK_KEYS].due=0;
+		schedule(elapsed);
+
+		#ifdef EGGTIMER_MODULE
+		if(ev & EV_NERF)							// after taskRtc(), the egg time starts at dt
+		eggTimerHit();
+		#endif
+
+		if(ev & EV_SECOND)							// keep hot state once per second
+		{
+			storeHot();
+			refreshMeasure();
+		}
+
+		#ifdef PROFILE_MODULE
+		profStore(&profBudget[PROF_LOOP], profStart);
+		#endif
 	}
 }
 
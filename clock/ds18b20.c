@@ -24,6 +24,9 @@ Other information from MAXIM's ibutton datasheet
 #include "ds18b20.h"
 #include "rtc.h"
 
+//state of the background conversion and its last result
+static uint8_t ds18b20_state = DS18X20_CONVERSION_DONE;
+static uint8_t ds18b20_lasttemp = 0;
 
 /*
  * ds18b20 init
@@ -50,8 +53,12 @@ uint8_t ds18b20_reset() {
 
 /*
  * write one bit
+ * only the 1uS start pulse is timing critical, interrupts are masked just for it.
+ * An interrupt in the rest of the slot stretches a 0 (allowed up to 120uS)
+ * or the recovery time after a 1.
  */
 void ds18b20_writebit(uint8_t bit){
+	uint8_t sreg = SREG;
 	cli();
 	//low for 1uS
 	DS18B20_PORT &= ~ (1<<DS18B20_DQ); //low
@@ -61,51 +68,55 @@ void ds18b20_writebit(uint8_t bit){
 	//if we want to write 1, release the line (if not will keep low)
 	if(bit)
 		DS18B20_DDR &= ~(1<<DS18B20_DQ); //input
+	SREG = sreg;
 
 	//wait 60uS and release the line
 	_delay_us(60); //80 instead of 60
 	DS18B20_DDR &= ~(1<<DS18B20_DQ); //input
-	sei();
 }
 
 /*
  * read one bit
+ * interrupts are masked only from the start pulse up to the sample (~10uS),
+ * the sensor holds the line for at least 15uS after the falling edge
  */
 uint8_t ds18b20_readbit(void){
 	uint8_t bit=0;
+	uint8_t sreg = SREG;
 	cli();
 	//low for 1uS
 	DS18B20_PORT &= ~ (1<<DS18B20_DQ); //low
 	DS18B20_DDR |= (1<<DS18B20_DQ); //output
 	_delay_us(1); //2 instead of 1
 
-	//release line and wait for 14uS
+	//release line and wait for 8uS
 	DS18B20_DDR &= ~(1<<DS18B20_DQ); //input
-	_delay_us(14);
+	_delay_us(8); //14 instead of 8
 
 	//read the value
 	if(DS18B20_PIN & (1<<DS18B20_DQ))
 		bit=1;
+	SREG = sreg;
 
-	//wait 45uS and return read value
-	_delay_us(45);
-	sei();
+	//wait 51uS and return read value
+	_delay_us(51);
 	return bit;
 }
 
 uint8_t ds18b20_bitio( uint8_t b )
 {
+  uint8_t sreg = SREG;
   cli();
   DS18B20_DDR |= 1<<DS18B20_DQ;
   _delay_us(1);
   if( b )
     DS18B20_DDR &= ~(1<<DS18B20_DQ);
-  _delay_us(14);
+  _delay_us(8);
   if( (DS18B20_PIN & (1<<DS18B20_DQ)) == 0 )
     b = 0;
-  _delay_us(45);
+  SREG = sreg;
+  _delay_us(51);
   DS18B20_DDR &= ~(1<<DS18B20_DQ);
-  sei();
   return b;
 }
 
@@ -227,21 +238,15 @@ uint8_t DS18X20_find_sensor( uint8_t *diff, uint8_t id[] )
 
 
 /*
- * get temperature for 1 sensor on the wire.
+ * read the result of the last conversion for 1 sensor on the wire.
  */
-//double ds18b20_gettemp() { //if we ever need floating point precision)
-uint8_t ds18b20_gettemp() {
+//double ds18b20_readtemp() { //if we ever need floating point precision)
+static uint8_t ds18b20_readtemp() {
 	uint8_t temperature[2];
 	int8_t digit;
 	uint16_t decimal;
 	//double retd = 0;
 
-	ds18b20_reset(); //reset
-	ds18b20_writebyte(DS18B20_CMD_SKIPROM); 	//skip ROM
-	ds18b20_writebyte(DS18B20_CMD_CONVERTTEMP); //start temperature conversion
-
-	// while(!ds18b20_readbit()); 					//wait until conversion is complete
-
 	ds18b20_reset(); //reset
 	ds18b20_writebyte(DS18B20_CMD_SKIPROM); 	//skip ROM
 	ds18b20_writebyte(DS18B20_CMD_RSCRATCHPAD); //read scratchpad
@@ -268,6 +273,44 @@ uint8_t ds18b20_gettemp() {
 }
 
 
+/*
+ * get temperature for 1 sensor on the wire.
+ */
+uint8_t ds18b20_gettemp() {
+	ds18b20_reset(); //reset
+	ds18b20_writebyte(DS18B20_CMD_SKIPROM); 	//skip ROM
+	ds18b20_writebyte(DS18B20_CMD_CONVERTTEMP); //start temperature conversion
+
+	// while(!ds18b20_readbit()); 					//wait until conversion is complete
+
+	return ds18b20_readtemp();
+}
+
+
+/*
+ * get temperature for 1 sensor on the wire without waiting for the conversion.
+ * The first call starts a conversion and returns at once, later calls
+ * return the cached value until the sensor releases the line when the
+ * conversion is complete (~750ms), then the new value is read and the
+ * next conversion is started.
+ */
+uint8_t ds18b20_update() {
+	if(ds18b20_state == DS18X20_CONVERSION_DONE) {
+		if(ds18b20_reset() == 0) { //presence pulse seen
+			ds18b20_writebyte(DS18B20_CMD_SKIPROM); 	//skip ROM
+			ds18b20_writebyte(DS18B20_CMD_CONVERTTEMP); //start temperature conversion
+			ds18b20_state = DS18X20_CONVERTING;
+		}
+	}
+	else if(ds18b20_readbit()) { //conversion is complete
+		ds18b20_lasttemp = ds18b20_readtemp();
+		ds18b20_state = DS18X20_CONVERSION_DONE;
+	}
+
+	return ds18b20_lasttemp;
+}
+
+
 void DS12B80_command( uint8_t command, uint8_t *id)
 {
 	uint8_t i;
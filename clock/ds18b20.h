@@ -79,6 +79,7 @@ Other information from MAXIM's ibutton datasheet
 //functions
 //extern double ds18b20_gettemp();
 extern uint8_t ds18b20_gettemp();
+extern uint8_t ds18b20_update();
 extern uint8_t ds18b20_getindextemp();
 extern uint8_t ds18b20_reset();
 extern uint8_t DS18X20_find_sensor();
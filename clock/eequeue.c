@@ -0,0 +1,100 @@
+/**************************
+ * file name: eequeue.c
+ **************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include "eequeue.h"
+
+#define EE_QUEUE_MASK (EE_QUEUE_SIZE-1)
+
+//Ring buffer of pending writes, filled by the main loop and drained by the EE_RDY ISR
+static uint16_t ee_address[EE_QUEUE_SIZE];
+static uint8_t ee_data[EE_QUEUE_SIZE];
+static volatile uint8_t ee_head;
+static volatile uint8_t ee_tail;
+
+/*******************************************************************
+  Start the write of the oldest queued byte which differs from the
+  EEPROM content. Call with interrupts disabled and EEWE cleared.
+  The ready interrupt stays enabled while bytes are queued. Other
+  EEPROM accesses must not run while the queue is not empty.
+********************************************************************/
+static void ee_next(void)
+{
+    while (ee_tail != ee_head)
+    {
+        EEAR = ee_address[ee_tail];
+        EECR |= (1<<EERE);
+        if (EEDR != ee_data[ee_tail])
+        {
+            EEDR = ee_data[ee_tail];
+            ee_tail = (ee_tail+1) & EE_QUEUE_MASK;
+            EECR |= (1<<EEMWE);
+            EECR |= (1<<EEWE);
+            EECR |= (1<<EERIE);
+            return;
+        }
+        ee_tail = (ee_tail+1) & EE_QUEUE_MASK;
+    }
+    EECR &= ~(1<<EERIE);
+}
+
+//EEPROM ready: the last write is done, start the next one
+ISR(EE_RDY_vect)
+{
+    ee_next();
+}
+
+//Write the next byte without the interrupt, busy waits for the running write
+static void ee_poll(void)
+{
+    uint8_t sreg;
+
+    while (EECR & (1<<EEWE));
+    sreg = SREG;
+    cli();
+    if (!(EECR & (1<<EEWE)))
+        ee_next();
+    SREG = sreg;
+}
+
+void ee_queue_byte(uint8_t *address, uint8_t data)
+{
+    uint8_t sreg;
+    uint8_t next = (ee_head+1) & EE_QUEUE_MASK;
+
+    while (next == ee_tail)
+        ee_poll();
+
+    ee_address[ee_head] = (uint16_t)address;
+    ee_data[ee_head] = data;
+
+    sreg = SREG;
+    cli();
+    ee_head = next;
+    EECR |= (1<<EERIE);     //fires as soon as EEWE is cleared
+    SREG = sreg;
+}
+
+void ee_queue_block(const void *src, void *dst, uint8_t length)
+{
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+
+    while (length--)
+        ee_queue_byte(d++, *s++);
+}
+
+uint8_t ee_pending(void)
+{
+    return (ee_head-ee_tail) & EE_QUEUE_MASK;
+}
+
+void ee_flush(void)
+{
+    while (ee_tail != ee_head)
+        ee_poll();
+    while (EECR & (1<<EEWE));
+}
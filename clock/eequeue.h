@@ -0,0 +1,33 @@
+/******************************
+ * file name: eequeue.h
+ ******************************/
+#ifndef EEQUEUE_H
+#define EEQUEUE_H
+
+#include <stdint.h>
+
+//Number of pending (address, byte) writes, must be a power of two
+#define EE_QUEUE_SIZE 16
+
+/*******************************************************************
+  Interface function to queue one EEPROM byte write and return at
+  once. The EE_RDY interrupt writes the queued bytes in the
+  background, bytes equal to the EEPROM content are skipped. If the
+  queue is full the oldest byte is written first (busy wait).
+********************************************************************/
+void ee_queue_byte(uint8_t *address, uint8_t data);
+
+//Interface function to queue "length" bytes from "src" for the EEPROM at "dst"
+void ee_queue_block(const void *src, void *dst, uint8_t length);
+
+//Interface function returning the number of bytes still to be written
+uint8_t ee_pending(void);
+
+/*******************************************************************
+  Interface function to wait until all queued bytes are written.
+  Works with interrupts disabled too. Call it before anything that
+  must find the EEPROM up to date (power down, reset, bootloader).
+********************************************************************/
+void ee_flush(void);
+
+#endif
@@ -0,0 +1,33 @@
+/******************************
+ * file name: multiplex.h
+ * build options of the display scan, shared by clock.c and multiplex.S
+ ******************************/
+#ifndef MULTIPLEX_H
+#define MULTIPLEX_H
+
+//dim by shorter multiplex slots (OCR1B) instead of skipping frames
+#define PWMDIM_MODULE
+
+//scan the lit led rows only, dark rows become idle slots at the end of the frame
+#define SKIP_EMPTY_ROWS
+
+/*******************************************************************
+  ASM_MULTIPLEX: scan the display with the naked assembler ISRs in
+  multiplex.S instead of the C versions in clock.c. They keep their
+  state in r2/r3, so every C file must be compiled with -ffixed-r2
+  -ffixed-r3. Build the "asm" configuration of clock.cproj, it
+  defines ASM_MULTIPLEX and adds the flags; the "default"
+  configuration keeps all registers for the compiler. No C code runs
+  in the slot interrupts then, PROFILE_MODULE needs the C versions.
+********************************************************************/
+
+//12 slots: 0-3 digits, 4-11 led rows, 3 bytes each (PORTA, PORTC, PORTD)
+#define SLOTS 12
+#define SLOT_SIZE 3
+
+#ifdef ASM_MULTIPLEX
+#define MUX_OFFSET r2       //byte offset of the current slot in slots[]
+#define MUX_FRAME r3        //frame counter for dimming by frame skipping
+#endif
+
+#endif
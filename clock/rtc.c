@@ -4,6 +4,7 @@
  **************************/
   
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <stdint.h>
 #include <util/delay.h>
 #include "rtc.h"
@@ -24,12 +25,21 @@
         : "I" (_SFR_IO_ADDR(port)),     \
           "I" (pin))
  
-//Timing requirement between data output and clock stobe high
-#define DATA_TO_CLK_SETUP()     \
-        __asm__ __volatile__ (  \
-        "nop\n\t"               \
-        "nop\n\t"               \
-        ::)
+//DS1302 minimum timings at 5V in ns (datasheet AC characteristics)
+#define T_CL_NS 250     //SCLK low time, covers data to clock setup (50ns)
+#define T_CH_NS 250     //SCLK high time
+#define T_CDD_NS 200    //SCLK low to read data valid
+#define T_CC_NS 1000    //CE high to SCLK high
+#define T_CWH_NS 1000   //CE inactive time
+
+//Busy wait of at least "ns" nanoseconds, cycles derived from F_CPU at compile time
+#define NS_TO_CYCLES(ns) (((ns)*(F_CPU/1000000UL)+999)/1000)
+#define DELAY_NS(ns) __builtin_avr_delay_cycles(NS_TO_CYCLES(ns))
+
+//Timing requirements around the clock strobes
+#define DATA_TO_CLK_SETUP() DELAY_NS(T_CL_NS)
+#define CLK_HIGH_HOLD() DELAY_NS(T_CH_NS)
+#define CLK_TO_DATA_VALID() DELAY_NS(T_CDD_NS)
  
 //Strobe CE pin of DS1302 high and low
 #define CE_STROBE_HIGH() IO_PIN_STROBE_HIGH(PORTB, 1)
@@ -57,6 +67,10 @@
  
 //RTC register WP write
 #define DT_WP_WRITE 0x8e
+
+//RAM burst read and write command
+#define RAM_BURST_READ 0xff
+#define RAM_BURST_WRITE 0xfe
  
 //Configure port pin directions for read and write DS1302
 #define WRITE_MODE() (DDRB |= 0x0e)
@@ -66,6 +80,26 @@
 //Read i/o value from DS1302
 #define IO_READ() (PINB & 0x04)
 
+//rtc_tick() calls per second (one per ms) and the poll interval used
+//to catch the second edge of the DS1302 on resync
+#define RTC_TICKS_PER_SECOND 1000
+#define RTC_TICKS_POLL (RTC_TICKS_PER_SECOND/64)
+
+//No DS1302 second read yet in this resync
+#define RTC_NO_SECOND 0xff
+
+//Software Calendar/Clock value and seconds until the next resync
+static dateTime rtc_cache;
+static uint16_t rtc_resync;
+static uint8_t rtc_sync_second = RTC_NO_SECOND;
+
+//Advanced by rtc_tick(), rtc_subticks are the ms of the current second
+static volatile uint16_t rtc_subticks;
+static volatile uint8_t rtc_elapsed;
+static volatile uint8_t rtc_ticks;
+
+int16_t rtc_drift_log[RTC_DRIFT_LOG];
+uint8_t rtc_drift_pos;
  
 //Prepare CE and SCLK for new operation
 static void reset(void)
@@ -73,12 +107,14 @@ static void reset(void)
     //Pull both CE and SCLK low to start with  
     SCLK_STROBE_LOW();
     CE_STROBE_LOW();
+    DELAY_NS(T_CWH_NS);
  
     //Comms. begin with CE stobe high
     CE_STROBE_HIGH();
+    DELAY_NS(T_CC_NS);
 }
  
-//Read one byte of Calendar/Clock data
+//Read one byte of Calendar/Clock data, LSB first
 static uint8_t read_byte(void)
 {
     uint8_t byte = 0;
@@ -90,25 +126,26 @@ static uint8_t read_byte(void)
     DISABLE_IO_PULLUP();
  
     //Read one byte of Calendar/Clock data
-    for(i = 0; i != 8; ++i)
+    for(i = 8; i != 0; --i)
     {
         //Strobe SCLK low to read I/O
         SCLK_STROBE_LOW();
-        _delay_us(1);
+        byte >>= 1;
+        CLK_TO_DATA_VALID();
  
         if(IO_READ() != 0)
         {
-            byte |= 1<<i;
+            byte |= 0x80;
         }
         //Strobe SCLK high for next I/O read
         SCLK_STROBE_HIGH();
-        _delay_us(1);
+        CLK_HIGH_HOLD();
     }
  
     return byte;
 }
  
-//Write one byte of control or Calendar/Clock data
+//Write one byte of control or Calendar/Clock data, LSB first
 static void write_byte(uint8_t byte)
 {
     uint8_t i;
@@ -117,14 +154,13 @@ static void write_byte(uint8_t byte)
     WRITE_MODE();
  
     //Write one byte of control or Calendar/Clock data
-    for(i = 0; i != 8; ++i)
+    for(i = 8; i != 0; --i)
     {
         //Start clock cycle with SCLK low
         SCLK_STROBE_LOW();
-        _delay_us(1);
  
         //Write bit value to I/O pin of DS1302         
-        if(((1<<i)&byte) == 0)
+        if((byte & 0x01) == 0)
         {
             IO_STROBE_LOW();
         }
@@ -132,12 +168,13 @@ static void write_byte(uint8_t byte)
         {
             IO_STROBE_HIGH();
         }
+        byte >>= 1;
  
         DATA_TO_CLK_SETUP(); //Data to clock setup
  
         //End clock cycle with SCLK high
         SCLK_STROBE_HIGH();
-        _delay_us(1);      
+        CLK_HIGH_HOLD();
     }
      
 }
@@ -145,9 +182,10 @@ static void write_byte(uint8_t byte)
 //Read 7 bytes of Calendar/Clock data
 static dateTime read_dt_block(void)
 {
-    uint8_t dt_byte;
     uint8_t byte_pos;
-    dateTime dt = {0};
+    dateTime dt;
+    //dateTime members are in DS1302 register order
+    uint8_t *dt_byte = (uint8_t *)&dt;
  
     //Always do a reset before a new operation
     reset();
@@ -155,37 +193,10 @@ static dateTime read_dt_block(void)
     //Write the clock burst read command into DS1302
     write_byte(DT_BURST_READ);
  
-    //Read each of the 7 Calendar/Clock bytes from DS1302
+    //Read each of the 7 Calendar/Clock bytes from DS1302 into place
     for(byte_pos = 0; byte_pos != 7; ++byte_pos)
     {
-        //Read one byte of calendar/clock data
-        dt_byte = read_byte();
-         
-        //Copy the read byte to the right place
-        switch(byte_pos)
-        {
-            case 0:
-                        dt.second = dt_byte;
-                        break;
-            case 1:
-                        dt.minute = dt_byte;
-                        break;
-            case 2:
-                        dt.hour = dt_byte;
-                        break;
-            case 3:
-                        dt.date = dt_byte;
-                        break;
-            case 4:
-                        dt.month = dt_byte;
-                        break;
-            case 5:
-                        dt.day = dt_byte;
-                        break;
-            case 6:
-                        dt.year = dt_byte;
-                        break;
-        }
+        dt_byte[byte_pos] = read_byte();
     }
  
     //Always end an operation with a reset
@@ -196,8 +207,9 @@ static dateTime read_dt_block(void)
 //Write 8 bytes of Calendar/Clock data
 static void write_dt_block(dateTime dt)
 {
-    uint8_t dt_byte;
     uint8_t byte_pos;
+    //dateTime members are in DS1302 register order
+    uint8_t *dt_byte = (uint8_t *)&dt;
  
     //Always do a reset before a new operation
     reset();
@@ -208,34 +220,7 @@ static void write_dt_block(dateTime dt)
     //Write each of the 7 Calendar/Clock byte to DS1302
     for(byte_pos = 0; byte_pos != 7; ++byte_pos)
     {
-        //Copy the right byte to write
-        switch(byte_pos)
-        {
-            case 0:
-                        dt_byte = dt.second;
-                        break;
-            case 1:
-                        dt_byte = dt.minute;
-                        break;
-            case 2:
-                        dt_byte = dt.hour;
-                        break;
-            case 3:
-                        dt_byte = dt.date;
-                        break;
-            case 4:
-                        dt_byte = dt.month;
-                        break;
-            case 5:
-                        dt_byte = dt.day;
-                        break;
-            case 6:
-                        dt_byte = dt.year;
-                        break;
-        }
- 
-        //Write one byte of Calendar/Clock data
-        write_byte(dt_byte);
+        write_byte(dt_byte[byte_pos]);
     }
  
     //Must write the 8th byte of the Calendar/Clock register
@@ -246,9 +231,9 @@ static void write_dt_block(dateTime dt)
 }
  
 /*******************************************************************
-  Interface function to initialize RTC: 1. Disable Clock Halt
-                                        2. Set to 24 hour mode
-                                        3. Disable Write Protection
+  Interface function to initialize RTC: 1. Disable Write Protection
+                                        2. Disable Clock Halt
+                                        3. Set to 24 hour mode
   No Calendar/Clock will be changed
 ********************************************************************/
 void rtc_init(void)
@@ -256,8 +241,13 @@ void rtc_init(void)
     uint8_t byte_second;
     uint8_t byte_hour;
  
-    //Disable Clock Halt
+    //Disable Write Protection first, every other write is ignored while it is set
     reset();
+    write_byte(DT_WP_WRITE);
+    write_byte(0);
+    reset();
+
+    //Disable Clock Halt
     write_byte(DT_SECONDS_READ);
     byte_second = read_byte();
     reset();
@@ -272,11 +262,6 @@ void rtc_init(void)
     write_byte(DT_HOURS_WRITE);
     write_byte(byte_hour & 0x7f);
     reset();
- 
-    //Disable Write Protection
-    write_byte(DT_WP_WRITE);
-    write_byte(0);
-    reset();
 }
  
 //Interface function to read Calendar/Clock value
@@ -305,16 +290,59 @@ dateTime get_date_time(void)
     return dt;
 }
  
+//Interface function to read the first "length" bytes of the DS1302 RAM in one burst
+void rtc_ram_read(uint8_t *buf, uint8_t length)
+{
+    reset();
+    write_byte(RAM_BURST_READ);
+    for(; length != 0; --length)
+    {
+        *buf++ = read_byte();
+    }
+    reset();
+}
+
+//Interface function to write the first "length" bytes of the DS1302 RAM in one burst
+void rtc_ram_write(const uint8_t *buf, uint8_t length)
+{
+    //RAM burst may end before all RTC_RAM_SIZE bytes are written
+    reset();
+    write_byte(RAM_BURST_WRITE);
+    for(; length != 0; --length)
+    {
+        write_byte(*buf++);
+    }
+    reset();
+}
+ 
+//Interface function to read only the seconds of the Calendar/Clock value
+uint8_t get_seconds(void)
+{
+    uint8_t second;
+
+    //Single register read: 16 clocks instead of the 64 of a burst
+    reset();
+    write_byte(DT_SECONDS_READ);
+    second = read_byte();
+    reset();
+
+    return (((second&0x70)>>4)*10) + (second&0x0f);
+}
+ 
 //Interface function to set Calendar/Clock value
 void set_date_time(dateTime dt)
 {
+    //Software clock takes the new value and resyncs at the next second edge
+    dt.second = 0;
+    rtc_cache = dt;
+    rtc_resync = 0;
+    rtc_sync_second = RTC_NO_SECOND;
+
     /**************************************************************
      Convert from normal decimal Calendar/Clock value to BCD. Hour
      is treated differently in 24 and AM/PM mode. Also the day of
      week is left as is.
     ***************************************************************/   
-    dt.second = 0;
-    //dt.second = ((dt.second/10)<<4) | (dt.second%10);
     dt.minute = ((dt.minute/10)<<4) | (dt.minute%10);
     if((dt.hour&0x80) == 0)
     {
@@ -326,3 +354,151 @@ void set_date_time(dateTime dt)
  
     write_dt_block(dt);
 }
+
+//Advance the software clock by one second, a new day is read from the DS1302
+static void rtc_advance(void)
+{
+    if(rtc_resync != 0)
+    {
+        --rtc_resync;
+    }
+
+    if(++rtc_cache.second < 60)
+    {
+        return;
+    }
+    rtc_cache.second = 0;
+    if(++rtc_cache.minute < 60)
+    {
+        return;
+    }
+    rtc_cache.minute = 0;
+    if(++rtc_cache.hour < 24)
+    {
+        return;
+    }
+    rtc_cache.hour = 0;
+    rtc_resync = 0;
+}
+
+//Log the drift of the software clock against the DS1302 at its second edge
+static void rtc_log_drift(dateTime dt, uint16_t subticks)
+{
+    int16_t drift;
+
+    //Seconds within the hour, a drift of more than half an hour wraps
+    drift = ((int16_t)rtc_cache.minute*60 + rtc_cache.second)
+            - ((int16_t)dt.minute*60 + dt.second);
+    if(drift > 1800)
+    {
+        drift -= 3600;
+    }
+    else if(drift < -1800)
+    {
+        drift += 3600;
+    }
+    if(drift > 31)
+    {
+        drift = 31;
+    }
+    else if(drift < -31)
+    {
+        drift = -31;
+    }
+
+    if(++rtc_drift_pos == RTC_DRIFT_LOG)
+    {
+        rtc_drift_pos = 0;
+    }
+    rtc_drift_log[rtc_drift_pos] = drift*1000 + (int16_t)subticks;
+}
+
+//Interface function to read the software Calendar/Clock value
+dateTime rtc_now(void)
+{
+    uint8_t sreg;
+    uint8_t elapsed;
+    uint8_t ticks;
+    uint8_t second;
+    uint16_t subticks;
+    dateTime dt;
+
+    sreg = SREG;
+    cli();
+    elapsed = rtc_elapsed;
+    rtc_elapsed = 0;
+    subticks = rtc_subticks;
+    ticks = rtc_ticks;
+    SREG = sreg;
+
+    //Advance by the seconds counted in the ISR
+    for(; elapsed != 0; --elapsed)
+    {
+        rtc_advance();
+    }
+
+    if((rtc_resync != 0) || (ticks != 0))
+    {
+        return rtc_cache;
+    }
+
+    /*************************************************************
+     Resync: poll the DS1302 seconds until they change. At that
+     edge the full Calendar/Clock value is read, the software
+     clock takes it and restarts the second, so both run in phase
+     until the next resync.
+    **************************************************************/
+    second = get_seconds();
+    if(rtc_sync_second == RTC_NO_SECOND)
+    {
+        rtc_sync_second = second;
+        if(rtc_cache.month == 0)
+        {
+            //Nothing read since power up
+            rtc_cache = get_date_time();
+        }
+        ticks = RTC_TICKS_POLL;
+    }
+    else if(second == rtc_sync_second)
+    {
+        ticks = RTC_TICKS_POLL;
+    }
+    else
+    {
+        dt = get_date_time();
+        rtc_log_drift(dt, subticks);
+        rtc_cache = dt;
+        rtc_resync = RTC_RESYNC_SECONDS;
+        rtc_sync_second = RTC_NO_SECOND;
+    }
+
+    cli();
+    if(ticks == 0)
+    {
+        rtc_subticks = 0;
+        rtc_elapsed = 0;
+    }
+    rtc_ticks = ticks;
+    SREG = sreg;
+
+    return rtc_cache;
+}
+
+//Interface function to advance the software clock, call it every ms
+uint8_t rtc_tick(void)
+{
+    uint8_t second = 0;
+
+    if(++rtc_subticks >= RTC_TICKS_PER_SECOND)
+    {
+        rtc_subticks = 0;
+        ++rtc_elapsed;
+        second = 1;
+    }
+
+    if(rtc_ticks != 0)
+    {
+        --rtc_ticks;
+    }
+    return second;
+}
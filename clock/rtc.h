@@ -17,17 +17,55 @@ typedef struct
 } dateTime;
  
 /*******************************************************************
-  Interface function to initialize RTC: 1. Disable Clock Halt
-                                        2. Set to 24 hour mode
-                                        3. Disable Write Protection
+  Interface function to initialize RTC: 1. Disable Write Protection
+                                        2. Disable Clock Halt
+                                        3. Set to 24 hour mode
   No Calendar/Clock will be changed
 ********************************************************************/
 void rtc_init(void);
  
 //Interface function to read Calendar/Clock value
 dateTime get_date_time(void);
+
+//Interface function to read only the seconds of the Calendar/Clock value
+uint8_t get_seconds(void);
  
 //Interface function to set Calendar/Clock value
 void set_date_time(dateTime dt);
+
+//Size of the battery backed RAM of the DS1302
+#define RTC_RAM_SIZE 31
+
+//Interface function to read the first "length" bytes of the DS1302 RAM in one burst
+void rtc_ram_read(uint8_t *buf, uint8_t length);
+
+//Interface function to write the first "length" bytes of the DS1302 RAM in one burst
+void rtc_ram_write(const uint8_t *buf, uint8_t length);
+
+//Seconds between two resyncs of the software clock with the DS1302
+#define RTC_RESYNC_SECONDS 600
+
+//Number of logged drifts, see rtc_drift_log
+#define RTC_DRIFT_LOG 8
+
+/*******************************************************************
+  Drift of the software clock seen at the last resyncs in ms, newest
+  at rtc_drift_log[rtc_drift_pos]. Positive means the software clock
+  was ahead of the DS1302. Use it to tune RTC_RESYNC_SECONDS.
+********************************************************************/
+extern int16_t rtc_drift_log[RTC_DRIFT_LOG];
+extern uint8_t rtc_drift_pos;
+
+/*******************************************************************
+  Interface function to read the software Calendar/Clock value.
+  The time is advanced by rtc_tick(). Every RTC_RESYNC_SECONDS, at
+  midnight and after set_date_time() it is resynchronised with the
+  DS1302 at the second edge of the chip.
+********************************************************************/
+dateTime rtc_now(void);
+
+//Interface function to advance the software clock, call it every ms from the Timer1 ISR.
+//Returns 1 when a new second has started, 0 otherwise.
+uint8_t rtc_tick(void);
  
 #endif
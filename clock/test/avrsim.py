@@ -0,0 +1,490 @@
+#!/usr/bin/env python3
+# Run one AVR function and count its cycles, for loops cycles.py can only count once.
+#
+#   avrsim.py [-n calls] file.elf|file.o ... function [name=value ...]
+#
+# Relocatable objects are linked here: code and PROGMEM data go to flash in file order,
+# the other data to SRAM from 0x60. "name=value" presets a register (r0..r31), a register
+# pair (r25:r24), a global variable (little endian, size of its symbol) or a port input
+# pin register (PINA..PINE, default 0xFF) before the call; "&name" is the address of a
+# global. TCNT1 counts F_CPU/8 from the start of the run.
+# Interrupt handlers (__vector_N) get 4 cycles of interrupt response and 2 of the rjmp
+# in the vector table. Prints the cycles and the globals given, after the run. With
+# "-n calls" the function is called that often in a row, e.g. an ISR for one second of
+# slots, and the shortest, average and longest call are printed.
+
+import struct
+import sys
+
+from cycles import Elf
+
+SRAM_END = 0x25F                                # ATmega8515
+IO_PINS = {'PINA': 0x19, 'PINB': 0x16, 'PINC': 0x13, 'PIND': 0x10, 'PINE': 0x05}
+SPL, SPH, SREG = 0x5D, 0x5E, 0x5F               # data space addresses
+TCNT1L, TCNT1H = 0x4C, 0x4D
+C, Z, N, V, S, H, T, I = (1 << b for b in range(8))
+
+
+class Avr:
+    def __init__(self, paths):
+        self.flash = bytearray(0x10000)             # clang objects exceed 8K, no wrap
+        self.ram = bytearray(0x10000)
+        self.symbols = {}                       # name -> (address, size, code)
+        self.undefined = {}                     # flash word -> symbol not in the files
+        self.targets = {}                       # flash word of a relocated rjmp/rcall -> target
+        self.pins = dict((a + 0x20, 0xFF) for a in IO_PINS.values())
+        self.cycles = 0
+        self.tcnt1_high = 0
+        flash, ram = 0, 0x60
+        placed = []
+        for path in paths:
+            elf = Elf(path)
+            base = {}
+            for i, s in enumerate(elf.sections):
+                if not s['flags'] & 2 or s['size'] == 0:
+                    continue                    # not SHF_ALLOC
+                code = bool(s['flags'] & 4) or s['name'].startswith('.progmem')
+                if s['name'].startswith('.eeprom') or s['addr'] >= 0x810000:
+                    continue
+                if elf.type == 2:               # linked: keep the addresses, SRAM at 0x800000
+                    addr = s['addr'] & 0xFFFF
+                    code = s['addr'] < 0x800000
+                elif code:
+                    flash += flash & 1
+                    addr, flash = flash, flash + s['size']
+                else:
+                    addr, ram = ram, ram + s['size']
+                mem = self.flash if code else self.ram
+                if s['type'] != 8:              # not SHT_NOBITS
+                    mem[addr:addr + s['size']] = s['data']
+                base[i] = (addr, code)
+            placed.append((elf, base))
+            for sym in elf.symbols:
+                if sym['shndx'] in base and sym['name'] and sym['type'] in (1, 2) and \
+                        (sym['bind'] != 0 or sym['name'] not in self.symbols):
+                    addr, code = base[sym['shndx']]
+                    value = sym['value'] if elf.type == 2 else addr + sym['value']
+                    self.symbols[sym['name']] = (value & 0xFFFF, sym['size'], code)
+        for elf, base in placed:
+            if elf.type != 2:
+                self.relocate(elf, base)
+
+    def relocate(self, elf, base):
+        for (sec, off), (sym, addend, typ) in elf.relocs.items():
+            if sec not in base:
+                continue
+            p, code = base[sec][0] + off, base[sec][1]
+            mem = self.flash if code else self.ram
+            if sym['shndx'] in base:
+                value = base[sym['shndx']][0] + sym['value'] + addend
+            elif sym['name'] in self.symbols:
+                value = self.symbols[sym['name']][0] + addend
+            else:
+                if code:
+                    self.undefined[p >> 1] = sym['name']    # fails when reached
+                continue
+            w = struct.unpack_from('<H', mem, p)[0]
+            if typ == 4:                        # R_AVR_16
+                w = value & 0xFFFF
+            elif typ == 5:                      # R_AVR_16_PM
+                w = (value >> 1) & 0xFFFF
+            elif typ in (6, 7, 9, 10, 12, 13):  # LO8/HI8 _LDI, _NEG, _PM
+                v = {6: value, 7: value >> 8, 9: -value, 10: -value >> 8,
+                     12: value >> 1, 13: value >> 9}[typ] & 0xFF
+                w = (w & 0xF0F0) | (v & 0x0F) | (v & 0xF0) << 4
+            elif typ == 2:                      # R_AVR_7_PCREL
+                w = (w & 0xFC07) | (((value - p - 2) >> 1) & 0x7F) << 3
+            elif typ == 3:                      # R_AVR_13_PCREL
+                w = (w & 0xF000) | ((value - p - 2) >> 1) & 0x0FFF
+                self.targets[p >> 1] = value >> 1
+            elif typ == 18:                     # R_AVR_CALL
+                k = value >> 1
+                w = (w & 0xFE0E) | (k >> 13 & 0x01F0) | (k >> 16 & 1)
+                struct.pack_into('<H', mem, p + 2, k & 0xFFFF)
+            elif typ == 1:                      # R_AVR_32
+                struct.pack_into('<I', mem, p, value)
+                continue
+            else:
+                raise SystemExit('relocation type %d not supported' % typ)
+            struct.pack_into('<H', mem, p, w)
+
+    # data space with the I/O registers of the inputs and Timer1
+    def read(self, a):
+        if a in self.pins:
+            return self.pins[a]
+        if a == TCNT1L:
+            t = self.cycles // 8
+            self.tcnt1_high = t >> 8 & 0xFF
+            return t & 0xFF
+        if a == TCNT1H:
+            return self.tcnt1_high
+        return self.ram[a]
+
+    def write(self, a, v):
+        self.ram[a] = v & 0xFF
+
+    def reg(self, r):
+        return self.ram[r]
+
+    def setreg(self, r, v):
+        self.ram[r] = v & 0xFF
+
+    def word(self, r):
+        return self.ram[r] | self.ram[r + 1] << 8
+
+    def setword(self, r, v):
+        self.ram[r] = v & 0xFF
+        self.ram[r + 1] = v >> 8 & 0xFF
+
+    def flag(self, f, on):
+        if on:
+            self.ram[SREG] |= f
+        else:
+            self.ram[SREG] &= ~f & 0xFF
+
+    def nzs(self, result, v):
+        self.flag(N, result & 0x80)
+        self.flag(Z, (result & 0xFF) == 0)
+        self.flag(V, v)
+        self.flag(S, bool(result & 0x80) != bool(v))
+
+    def push(self, v):
+        sp = self.word(SPL)
+        self.ram[sp] = v & 0xFF
+        self.setword(SPL, sp - 1)
+
+    def pop(self):
+        sp = self.word(SPL) + 1
+        self.setword(SPL, sp)
+        return self.ram[sp]
+
+    def fetch(self, pc):
+        return struct.unpack_from('<H', self.flash, 2 * pc)[0]
+
+    def size(self, pc):
+        w = self.fetch(pc)
+        return 2 if (w & 0xFE0F) in (0x9000, 0x9200) or (w & 0xFE0C) == 0x940C else 1
+
+    def add(self, d, a, b, carry):
+        r = a + b + carry
+        self.flag(H, ((a & 0xF) + (b & 0xF) + carry) & 0x10)
+        self.flag(C, r & 0x100)
+        self.nzs(r, bool(~(a ^ b) & (a ^ r) & 0x80))
+        if d is not None:
+            self.setreg(d, r)
+
+    def sub(self, d, a, b, carry, keep_z=False):
+        r = (a - b - carry) & 0x1FF
+        z = self.ram[SREG] & Z
+        self.flag(H, ((a & 0xF) - (b & 0xF) - carry) & 0x10)
+        self.flag(C, r & 0x100)
+        self.nzs(r, bool((a ^ b) & (a ^ r) & 0x80))
+        if keep_z:
+            self.flag(Z, (r & 0xFF) == 0 and z)
+        if d is not None:
+            self.setreg(d, r)
+
+    def logic(self, d, r):
+        self.setreg(d, r)
+        self.nzs(r, False)
+
+    def run(self, name, limit=1000000):
+        if name not in self.symbols or not self.symbols[name][2]:
+            raise SystemExit('%s: no such function' % name)
+        self.setword(SPL, SRAM_END)
+        self.push(0xFF)                         # return address 0xFFFF ends the run
+        self.push(0xFF)
+        pc = self.symbols[name][0] >> 1
+        if name.startswith('__vector_'):
+            self.cycles += 6
+            self.flag(I, False)
+        steps = 0
+        while pc != 0xFFFF:
+            steps += 1
+            if steps > limit:
+                raise SystemExit('%s: no return after %d instructions' % (name, steps))
+            pc = self.step(pc)
+        return self.cycles
+
+    def skip(self, pc, cond):
+        if cond:
+            words = self.size(pc + 1)
+            self.cycles += 1 + words
+            return pc + 1 + words
+        self.cycles += 1
+        return pc + 1
+
+    def step(self, pc):
+        if pc in self.undefined:
+            raise SystemExit('%s is not in the given files' % self.undefined[pc])
+        w = self.fetch(pc)
+        d = w >> 4 & 0x1F
+        r = (w & 0x0F) | (w >> 5 & 0x10)
+        K = (w & 0x0F) | (w >> 4 & 0xF0)
+        dh = 16 + (w >> 4 & 0x0F)
+        sreg = self.ram[SREG]
+        self.cycles += 1
+        nxt = pc + 1
+
+        if w == 0x0000:
+            pass                                                # nop
+        elif (w & 0xFF00) == 0x0100:                            # movw
+            dd, rr = (w >> 4 & 0xF) * 2, (w & 0xF) * 2
+            self.setword(dd, self.word(rr))
+        elif (w & 0xFC00) == 0x9C00:                            # mul
+            p = self.reg(d) * self.reg(r)
+            self.setword(0, p)
+            self.flag(C, p & 0x8000)
+            self.flag(Z, p == 0)
+            self.cycles += 1
+        elif (w & 0xFF00) == 0x0200:                            # muls
+            a, b = self.reg(16 + (w >> 4 & 0xF)), self.reg(16 + (w & 0xF))
+            p = ((a - 256 if a & 0x80 else a) * (b - 256 if b & 0x80 else b)) & 0xFFFF
+            self.setword(0, p)
+            self.flag(C, p & 0x8000)
+            self.flag(Z, p == 0)
+            self.cycles += 1
+        elif (w & 0xFF88) == 0x0300:                            # mulsu
+            a, b = self.reg(16 + (w >> 4 & 7)), self.reg(16 + (w & 7))
+            p = ((a - 256 if a & 0x80 else a) * b) & 0xFFFF
+            self.setword(0, p)
+            self.flag(C, p & 0x8000)
+            self.flag(Z, p == 0)
+            self.cycles += 1
+        elif (w & 0xFC00) == 0x0400:                            # cpc
+            self.sub(None, self.reg(d), self.reg(r), sreg & C, True)
+        elif (w & 0xFC00) == 0x0800:                            # sbc
+            self.sub(d, self.reg(d), self.reg(r), sreg & C, True)
+        elif (w & 0xFC00) == 0x0C00:                            # add
+            self.add(d, self.reg(d), self.reg(r), 0)
+        elif (w & 0xFC00) == 0x1000:                            # cpse
+            self.cycles -= 1
+            return self.skip(pc, self.reg(d) == self.reg(r))
+        elif (w & 0xFC00) == 0x1400:                            # cp
+            self.sub(None, self.reg(d), self.reg(r), 0)
+        elif (w & 0xFC00) == 0x1800:                            # sub
+            self.sub(d, self.reg(d), self.reg(r), 0)
+        elif (w & 0xFC00) == 0x1C00:                            # adc
+            self.add(d, self.reg(d), self.reg(r), sreg & C)
+        elif (w & 0xFC00) == 0x2000:                            # and
+            self.logic(d, self.reg(d) & self.reg(r))
+        elif (w & 0xFC00) == 0x2400:                            # eor
+            self.logic(d, self.reg(d) ^ self.reg(r))
+        elif (w & 0xFC00) == 0x2800:                            # or
+            self.logic(d, self.reg(d) | self.reg(r))
+        elif (w & 0xFC00) == 0x2C00:                            # mov
+            self.setreg(d, self.reg(r))
+        elif (w & 0xF000) == 0x3000:                            # cpi
+            self.sub(None, self.reg(dh), K, 0)
+        elif (w & 0xF000) == 0x4000:                            # sbci
+            self.sub(dh, self.reg(dh), K, sreg & C, True)
+        elif (w & 0xF000) == 0x5000:                            # subi
+            self.sub(dh, self.reg(dh), K, 0)
+        elif (w & 0xF000) == 0x6000:                            # ori
+            self.logic(dh, self.reg(dh) | K)
+        elif (w & 0xF000) == 0x7000:                            # andi
+            self.logic(dh, self.reg(dh) & K)
+        elif (w & 0xD000) == 0x8000:                            # ldd/std Y+q, Z+q
+            q = (w & 7) | (w >> 7 & 0x18) | (w >> 8 & 0x20)
+            a = self.word(28 if w & 8 else 30) + q
+            if w & 0x0200:
+                self.write(a, self.reg(d))
+            else:
+                self.setreg(d, self.read(a))
+            self.cycles += 1
+        elif (w & 0xFC0F) == 0x9000:                            # lds/sts
+            a = self.fetch(pc + 1)
+            if w & 0x0200:
+                self.write(a, self.reg(d))
+            else:
+                self.setreg(d, self.read(a))
+            self.cycles += 1
+            nxt = pc + 2
+        elif (w & 0xFC00) == 0x9000 and (w & 0xF) in (4, 5, 6, 7) and not w & 0x0200:
+            z = self.word(30)                                   # lpm Rd, Z(+)
+            self.setreg(d, self.flash[z])
+            if w & 1:
+                self.setword(30, z + 1)
+            self.cycles += 2
+        elif (w & 0xFC0F) == 0x900F:                            # pop / push
+            if w & 0x0200:
+                self.push(self.reg(d))
+            else:
+                self.setreg(d, self.pop())
+            self.cycles += 1
+        elif (w & 0xFC00) == 0x9000:                            # ld/st X, Y, Z with +/-
+            mode = w & 0xF
+            ptr = {0x1: 30, 0x2: 30, 0x9: 28, 0xA: 28, 0xC: 26, 0xD: 26, 0xE: 26}.get(mode)
+            if ptr is None:
+                raise SystemExit('unknown instruction %04X at %04X' % (w, 2 * pc))
+            a = self.word(ptr)
+            if mode in (0x2, 0xA, 0xE):
+                a = (a - 1) & 0xFFFF
+                self.setword(ptr, a)
+            if w & 0x0200:
+                self.write(a, self.reg(d))
+            else:
+                self.setreg(d, self.read(a))
+            if mode in (0x1, 0x9, 0xD):
+                self.setword(ptr, a + 1)
+            self.cycles += 1
+        elif (w & 0xFE0E) == 0x940C or (w & 0xFE0E) == 0x940E:  # jmp / call
+            k = (w >> 3 & 0x3E | w & 1) << 16 | self.fetch(pc + 1)
+            if w & 2:
+                self.push(pc + 2)
+                self.push(pc + 2 >> 8)
+                self.cycles += 3
+            else:
+                self.cycles += 2
+            nxt = k
+        elif (w & 0xFE00) == 0x9400 and (w & 0xF) in (0, 1, 2, 3, 5, 6, 7, 0xA):   # one operand
+            op, v = w & 0xF, self.reg(d)
+            if op == 0x0:                                       # com
+                self.logic(d, ~v)
+                self.flag(C, True)
+            elif op == 0x1:                                     # neg
+                self.sub(d, 0, v, 0)
+            elif op == 0x2:                                     # swap
+                self.setreg(d, v >> 4 | v << 4)
+            elif op == 0x3:                                     # inc
+                self.setreg(d, v + 1)
+                self.nzs(v + 1, v == 0x7F)
+            elif op in (0x5, 0x6, 0x7):                         # asr, lsr, ror
+                top = {0x5: v & 0x80, 0x6: 0, 0x7: (sreg & C) << 7}[op]
+                res = v >> 1 | top
+                self.setreg(d, res)
+                self.flag(C, v & 1)
+                self.nzs(res, bool(res & 0x80) != bool(v & 1))
+            elif op == 0xA:                                     # dec
+                self.setreg(d, v - 1)
+                self.nzs(v - 1, v == 0x80)
+        elif (w & 0xFF0F) == 0x9408:                            # bset / bclr
+            self.flag(1 << (w >> 4 & 7), not w & 0x80)
+        elif w in (0x9508, 0x9518):                             # ret / reti
+            nxt = self.pop() << 8
+            nxt |= self.pop()
+            if w == 0x9518:
+                self.flag(I, True)
+            self.cycles += 3
+        elif w in (0x9588, 0x95A8):                             # sleep, wdr
+            pass
+        elif w == 0x95C8:                                       # lpm
+            self.setreg(0, self.flash[self.word(30)])
+            self.cycles += 2
+        elif w == 0x9409:                                       # ijmp
+            nxt = self.word(30)
+            self.cycles += 1
+        elif w == 0x9509:                                       # icall
+            self.push(pc + 1)
+            self.push(pc + 1 >> 8)
+            nxt = self.word(30)
+            self.cycles += 2
+        elif (w & 0xFE00) in (0x9600, 0x9700):                  # adiw / sbiw
+            rr = 24 + (w >> 3 & 6)
+            k = (w & 0xF) | (w >> 2 & 0x30)
+            a = self.word(rr)
+            res = (a - k if w & 0x0100 else a + k) & 0xFFFF
+            self.setword(rr, res)
+            if w & 0x0100:
+                c, v = res > a, bool(a & 0x8000) and not res & 0x8000
+            else:
+                c, v = res < a, not a & 0x8000 and bool(res & 0x8000)
+            self.flag(C, c)
+            self.flag(N, res & 0x8000)
+            self.flag(Z, res == 0)
+            self.flag(V, v)
+            self.flag(S, bool(res & 0x8000) != bool(v))
+            self.cycles += 1
+        elif (w & 0xFC00) == 0x9800:                            # cbi, sbic, sbi, sbis
+            a, b = 0x20 + (w >> 3 & 0x1F), w & 7
+            op = w >> 8 & 3
+            if op in (0, 2):
+                v = self.read(a)
+                self.write(a, v | 1 << b if op == 2 else v & ~(1 << b))
+                self.cycles += 1
+            else:
+                self.cycles -= 1
+                return self.skip(pc, bool(self.read(a) & 1 << b) == (op == 3))
+        elif (w & 0xF000) == 0xB000:                            # in / out
+            a = 0x20 + ((w & 0xF) | (w >> 5 & 0x30))
+            if w & 0x0800:
+                self.write(a, self.reg(d))
+            else:
+                self.setreg(d, self.read(a))
+        elif (w & 0xE000) == 0xC000:                            # rjmp / rcall
+            k = w & 0x0FFF
+            k = k - 0x1000 if k & 0x800 else k
+            if w & 0x1000:
+                self.push(pc + 1)
+                self.push(pc + 1 >> 8)
+                self.cycles += 2
+            else:
+                self.cycles += 1
+            nxt = self.targets.get(pc, (pc + 1 + k) & 0x0FFF)
+        elif (w & 0xF000) == 0xE000:                            # ldi
+            self.setreg(dh, K)
+        elif (w & 0xF800) == 0xF000:                            # brbs / brbc
+            k = w >> 3 & 0x7F
+            k = k - 0x80 if k & 0x40 else k
+            if bool(sreg & 1 << (w & 7)) != bool(w & 0x0400):
+                self.cycles += 1
+                nxt = pc + 1 + k
+        elif (w & 0xFC08) == 0xF800:                            # bld / bst
+            if w & 0x0200:
+                self.flag(T, self.reg(d) & 1 << (w & 7))
+            else:
+                v = self.reg(d) & ~(1 << (w & 7))
+                self.setreg(d, v | (1 << (w & 7) if sreg & T else 0))
+        elif (w & 0xFC08) == 0xFC00:                            # sbrc / sbrs
+            self.cycles -= 1
+            return self.skip(pc, bool(self.reg(d) & 1 << (w & 7)) == bool(w & 0x0200))
+        else:
+            raise SystemExit('unknown instruction %04X at %04X' % (w, 2 * pc))
+        return nxt
+
+
+def main():
+    args = sys.argv[1:]
+    calls = 1
+    if args[:1] == ['-n']:
+        calls, args = int(args[1]), args[2:]
+    paths = [a for a in args if a.endswith(('.o', '.elf'))]
+    rest = [a for a in args if a not in paths]
+    if not paths or not rest or '=' in rest[0]:
+        raise SystemExit('usage: avrsim.py [-n calls] file.elf|file.o ... function [name=value ...]')
+    avr = Avr(paths)
+    name, presets = rest[0], [a.split('=') for a in rest[1:]]
+    shown = []
+    for key, value in presets:
+        value = avr.symbols[value[1:]][0] if value[0] == '&' else int(value, 0)
+        if key[0] == 'r' and ':' in key:
+            avr.setword(int(key.split(':')[1][1:]), value)
+        elif key[0] == 'r' and key[1:].isdigit():
+            avr.setreg(int(key[1:]), value)
+        elif key in IO_PINS:
+            avr.pins[IO_PINS[key] + 0x20] = value & 0xFF
+        elif key in avr.symbols and not avr.symbols[key][2]:
+            addr, size, _ = avr.symbols[key]
+            avr.ram[addr:addr + size] = value.to_bytes(size, 'little')
+            shown.append(key)
+        else:
+            raise SystemExit('%s: no register, pin register or global variable' % key)
+    runs = []
+    for i in range(calls):
+        start = avr.cycles
+        avr.run(name)
+        runs.append(avr.cycles - start)
+    if calls == 1:
+        out = ['%s: %d cycles' % (name, runs[0])]
+    else:
+        out = ['%s: %d calls, min %d avg %.1f max %d cycles' %
+               (name, calls, min(runs), sum(runs) / calls, max(runs))]
+    for key in shown:
+        addr, size, _ = avr.symbols[key]
+        out.append('%s=%d' % (key, int.from_bytes(avr.ram[addr:addr + size], 'little')))
+    out.append('r24=%d r25=%d' % (avr.reg(24), avr.reg(25)))
+    print(' '.join(out))
+
+
+if __name__ == '__main__':
+    main()
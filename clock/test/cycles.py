@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+# Cycle counts of AVR functions, read from linked ELF files or relocatable objects.
+#
+#   cycles.py file.elf|file.o ... [function ...]
+#
+# For each function the shortest and the longest path from the entry to its ret/reti
+# are counted with the cycles of the classic AVR core (ATmega8515), calls included.
+# A loop is counted once: the path ends at the jump back and the function is marked
+# "loop", avrsim.py runs such a function for exact counts. Interrupt handlers
+# (__vector_N) get 4 cycles of interrupt response and 2 of the rjmp in the vector table. Indirect calls and jumps (icall, ijmp) are marked "ind"
+# and count their own cycles only, calls into files not given are marked "ext:name".
+# Without function names the vectors are listed.
+
+import struct
+import sys
+
+sys.setrecursionlimit(20000)
+
+
+class Elf:
+    def __init__(self, path):
+        data = open(path, 'rb').read()
+        if data[:4] != b'\x7fELF' or data[4] != 1:
+            raise SystemExit('%s: not an ELF32 file' % path)
+        self.path = path
+        (self.type, _, _, _, _, shoff, _, _, _, _, shentsize, shnum, shstrndx) = \
+            struct.unpack_from('<HHIIIIIHHHHHH', data, 16)
+        self.sections = []
+        for i in range(shnum):
+            name, typ, flags, addr, off, size, link, info, align, entsize = \
+                struct.unpack_from('<IIIIIIIIII', data, shoff + i * shentsize)
+            self.sections.append(dict(name=name, type=typ, flags=flags, addr=addr,
+                                      data=data[off:off + size] if typ != 8 else b'',
+                                      size=size, link=link, info=info))
+        names = self.sections[shstrndx]['data']
+        for s in self.sections:
+            s['name'] = names[s['name']:names.index(b'\0', s['name'])].decode()
+
+        self.symbols = []
+        for s in self.sections:
+            if s['type'] != 2:                  # SHT_SYMTAB
+                continue
+            strtab = self.sections[s['link']]['data']
+            for off in range(0, len(s['data']), 16):
+                name, value, size, info, other, shndx = struct.unpack_from('<IIIBBH', s['data'], off)
+                name = strtab[name:strtab.index(b'\0', name)].decode()
+                self.symbols.append(dict(name=name, value=value, size=size,
+                                         type=info & 15, bind=info >> 4, shndx=shndx))
+
+        # relocations by (section, offset) -> (symbol, addend, type)
+        self.relocs = {}
+        for s in self.sections:
+            if s['type'] != 4:                  # SHT_RELA
+                continue
+            for off in range(0, len(s['data']), 12):
+                offset, info, addend = struct.unpack_from('<IIi', s['data'], off)
+                self.relocs[(s['info'], offset)] = (self.symbols[info >> 8], addend, info & 255)
+
+    def offset(self, sec, addr):
+        # section offset of a code address of a linked file
+        return addr - self.sections[sec]['addr'] if self.type == 2 else addr
+
+
+class Code:
+    def __init__(self, paths):
+        self.files = [Elf(p) for p in paths]
+        self.functions = {}                     # name -> (file, section, start, end)
+        self.starts = {}                        # (file, section, offset) -> name
+        for f, elf in enumerate(self.files):
+            for sym in elf.symbols:
+                if sym['type'] != 2 or sym['shndx'] == 0 or sym['shndx'] >= 0xff00:
+                    continue                    # STT_FUNC defined here
+                start = elf.offset(sym['shndx'], sym['value'])
+                loc = (f, sym['shndx'], start, start + sym['size'])
+                if sym['bind'] != 0 or sym['name'] not in self.functions:
+                    self.functions[sym['name']] = loc
+                self.starts[loc[:3]] = sym['name']
+        self.memo = {}
+        self.active = set()
+
+    def word(self, f, sec, off):
+        data = self.files[f].sections[sec]['data']
+        return struct.unpack_from('<H', data, off)[0] if off + 2 <= len(data) else 0
+
+    def target(self, f, sec, off, field):
+        # (file, section, offset) a branch, jump or call at off goes to
+        elf = self.files[f]
+        rel = elf.relocs.get((sec, off))
+        if rel:
+            sym, addend, typ = rel
+            if sym['shndx'] == 0:               # defined in another file
+                loc = self.functions.get(sym['name'])
+                return (loc[0], loc[1], loc[2] + addend) if loc else sym['name']
+            return (f, sym['shndx'], sym['value'] + addend)
+        if field is None:
+            return None
+        if field[0] == 'abs':
+            addr = field[1]
+            for i, s in enumerate(elf.sections):
+                if s['flags'] & 4 and s['addr'] <= addr < s['addr'] + s['size']:
+                    return (f, i, addr - s['addr'])
+            return None
+        return (f, sec, off + 2 + 2 * field[1])
+
+    def decode(self, f, sec, off):
+        # (size, kind, cycles, field): kind is op, br, skip, jmp, call, ret, ijmp, icall
+        w = self.word(f, sec, off)
+        if (w & 0xFE0F) in (0x9000, 0x9200):
+            return 4, 'op', 2, None             # lds, sts
+        if (w & 0xFE0E) == 0x940C:
+            k = ((w & 0x01F0) << 13 | (w & 1) << 16 | self.word(f, sec, off + 2)) * 2
+            return 4, 'jmp', 3, ('abs', k)
+        if (w & 0xFE0E) == 0x940E:
+            k = ((w & 0x01F0) << 13 | (w & 1) << 16 | self.word(f, sec, off + 2)) * 2
+            return 4, 'call', 4, ('abs', k)
+        if w in (0x9508, 0x9518):
+            return 2, 'ret', 4, None            # ret, reti
+        if w == 0x9409:
+            return 2, 'ijmp', 2, None
+        if w == 0x9509:
+            return 2, 'icall', 3, None
+        if w in (0x95C8, 0x95D8):
+            return 2, 'op', 3, None             # lpm, elpm r0
+        if (w & 0xFC00) == 0x1000 or (w & 0xFC00) in (0xFC00,) or (w & 0xFD00) == 0x9900:
+            return 2, 'skip', 1, None           # cpse, sbrc/sbrs, sbic/sbis
+        if (w & 0xF000) == 0xC000:
+            k = w & 0x0FFF
+            return 2, 'jmp', 2, ('rel', k - 0x1000 if k & 0x0800 else k)
+        if (w & 0xF000) == 0xD000:
+            k = w & 0x0FFF
+            return 2, 'call', 3, ('rel', k - 0x1000 if k & 0x0800 else k)
+        if (w & 0xF800) == 0xF000:
+            k = (w >> 3) & 0x7F
+            return 2, 'br', 1, ('rel', k - 0x80 if k & 0x40 else k)
+        if (w & 0xFE00) in (0x9000, 0x9200):
+            if (w & 0xFE0E) == 0x9004 or (w & 0xFE0E) == 0x9006:
+                return 2, 'op', 3, None         # lpm, elpm Z
+            return 2, 'op', 2, None             # ld, st, push, pop
+        if (w & 0xD000) == 0x8000:
+            return 2, 'op', 2, None             # ldd, std
+        if (w & 0xFE00) in (0x9600, 0x9700):
+            return 2, 'op', 2, None             # adiw, sbiw
+        if (w & 0xFD00) == 0x9800:
+            return 2, 'op', 2, None             # cbi, sbi
+        if (w & 0xFC00) == 0x9C00 or (w & 0xFF00) in (0x0200, 0x0300):
+            return 2, 'op', 2, None             # mul, muls, mulsu, fmul
+        return 2, 'op', 1, None
+
+    def successors(self, name, off, flags):
+        # [(min, max, next)] of the instruction at off, next None where the path ends
+        f, sec, start, end = self.functions[name]
+        size, kind, cycles, field = self.decode(f, sec, off)
+        nxt = off + size
+        if kind == 'ret':
+            return [(cycles, cycles, None)]
+        if kind == 'br':
+            t = self.target(f, sec, off, field)
+            local = isinstance(t, tuple) and t[:2] == (f, sec)
+            return [(1, 1, nxt), (2, 2, t[2] if local else None)]
+        if kind == 'skip':
+            words = self.decode(f, sec, nxt)[0] // 2
+            return [(1, 1, nxt), (1 + words, 1 + words, nxt + 2 * words)]
+        if kind == 'jmp':
+            t = self.target(f, sec, off, field)
+            if isinstance(t, tuple) and t[:2] == (f, sec) and start < t[2] < end:
+                return [(cycles, cycles, t[2])]
+            a, b = self.callee(t, flags)        # tail call
+            return [(a + cycles, b + cycles, None)]
+        if kind == 'call':
+            a, b = self.callee(self.target(f, sec, off, field), flags)
+            return [(a + cycles, b + cycles, nxt)]
+        if kind in ('ijmp', 'icall'):
+            flags.add('ind')
+            return [(cycles, cycles, nxt if kind == 'icall' else None)]
+        if nxt >= end:
+            return [(cycles, cycles, None)]     # falls off the end, e.g. after a noreturn call
+        return [(cycles, cycles, nxt)]
+
+    def function(self, name):
+        # (min, max, flags) of a function, calls included
+        if name in self.memo:
+            return self.memo[name]
+        if name in self.active:
+            return 0, 0, {'recursion'}
+        self.active.add(name)
+        start = self.functions[name][2]
+        flags = set()
+        state = {}                              # offset -> 'busy' or (min, max)
+
+        def path(off):
+            # shortest and longest path from off, a loop is counted once
+            if off in state:
+                if state[off] == 'busy':
+                    flags.add('loop')
+                    return 0, 0
+                return state[off]
+            state[off] = 'busy'
+            lo = hi = None
+            for a, b, nxt in self.successors(name, off, flags):
+                c, d = path(nxt) if nxt is not None else (0, 0)
+                lo = a + c if lo is None else min(lo, a + c)
+                hi = b + d if hi is None else max(hi, b + d)
+            state[off] = lo, hi
+            return state[off]
+
+        lo, hi = path(start)
+        if name.startswith('__vector_'):
+            lo, hi = lo + 6, hi + 6
+        self.active.discard(name)
+        self.memo[name] = (lo, hi, flags)
+        return self.memo[name]
+
+    def callee(self, loc, flags):
+        if isinstance(loc, str):
+            flags.add('ext:' + loc)             # not in the given files, e.g. libgcc
+            return 0, 0
+        name = self.starts.get(loc)
+        if name is None:
+            flags.add('ind')
+            return 0, 0
+        lo, hi, sub = self.function(name)
+        flags.update(sub - {'recursion'})
+        return lo, hi
+
+
+def main():
+    paths = [a for a in sys.argv[1:] if a.endswith(('.o', '.elf'))]
+    names = [a for a in sys.argv[1:] if a not in paths]
+    if not paths:
+        raise SystemExit('usage: cycles.py file.elf|file.o ... [function ...]')
+    code = Code(paths)
+    if not names:
+        names = sorted((n for n in code.functions if n.startswith('__vector_')),
+                       key=lambda n: int(n[9:]) if n[9:].isdigit() else 999)
+    print('%-24s %8s %8s' % ('function', 'min', 'max'))
+    for n in names:
+        if n not in code.functions:
+            print('%-24s %8s' % (n, 'missing'))
+            continue
+        lo, hi, flags = code.function(n)
+        print('%-24s %8d %8d  %s' % (n, lo, hi, ' '.join(sorted(flags))))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,412 @@
+/******************************
+ * file name: test/leds_ref.c
+ * computingLeds() of the code base before the led pattern engine, kept
+ * as the reference test_clock.c compares the engine against. Only the
+ * storage class changed and cli()/sei() are gone, the host has no ISR.
+ ******************************/
+
+#include <stdint.h>
+#include "../rtc.h"
+#include "leds_ref.h"
+
+#define LEDS_CASE9
+#define LEDS_SHOW_HOURMIN
+#define NERFGUN_MODULE
+#define SETSECMODE		0x13
+
+static uint8_t d[18], seconds, mySeed, minutesOld;
+static uint8_t SecMode, ClockMode;
+static uint16_t refresh;
+static dateTime dt;
+
+static uint8_t randSec()
+{
+	uint8_t myBool2=0, myBool4=0, myBool8=0, myBool128=0;
+
+	if (mySeed & 2)
+	myBool2=1;
+
+	if (mySeed & 4)
+	myBool4=1;
+
+	if (mySeed & 8)
+	myBool8=1;
+
+	if (mySeed & 128)
+	myBool128=1;
+
+	mySeed <<= 1;
+	if( ((myBool2 ^ myBool4) ^ myBool8) ^ myBool128 )
+	mySeed++;
+
+	if(mySeed<60)
+	return mySeed;
+	else
+	return (mySeed & 59);
+}
+
+
+
+//tool function to calculate the power of 2
+static uint8_t p2(uint8_t exponent)
+{
+	uint8_t a=1,b=1,i;
+	for(i=0;i<=exponent-1;i++)
+	{
+		b*=2;
+		a+=b;
+	}
+	return a;
+}
+
+
+//tool function to convert from decimal to binary display
+static uint8_t dectobin(uint8_t number)
+{
+	uint8_t a,i;
+	a=1;
+	if (number==0) 	a=1;
+	else
+	for (i=0;i<number;i++) a=a*2;
+	return a;
+}
+
+
+//tool function to show if an integer is odd or even
+static uint8_t odd(uint8_t num)
+{
+	return num%2;
+}
+
+
+static uint8_t bb(uint8_t in11, uint8_t sec1, uint8_t sec2) //function to reduce the code
+{
+	return dectobin(seconds-in11*8)*((seconds>= sec1) && (seconds<= sec2));
+}
+
+
+static void cc(uint8_t d0,uint8_t d1,uint8_t d2,uint8_t d3,uint8_t d4,uint8_t d5,uint8_t d6,uint8_t d7, uint8_t in111)
+{
+	d[10]=d0 | bb(in111,0,7);
+	d[11]=d1 | bb(in111,8,15);
+	d[12]=d2 | bb(in111,16,23);
+	d[13]=d3 | bb(in111,24,31);
+	d[14]=d4 | bb(in111,32,39);
+	d[15]=d5 | bb(in111,40,47);
+	d[16]=d6 | bb(in111,48,55);
+	d[17]=d7 | bb(in111,56,59);
+}
+
+
+static void displayMinutes()
+{
+	uint8_t in111 = seconds/8;
+	d[10]|= bb(in111,0,7);
+	d[11]|= bb(in111,8,15);
+	d[12]|= bb(in111,16,23);
+	d[13]|= bb(in111,24,31);
+	d[14]|= bb(in111,32,39);
+	d[15]|= bb(in111,40,47);
+	d[16]|= bb(in111,48,55);
+	d[17]|= bb(in111,56,59);
+}
+
+static void displayMinutesInv()
+{
+	uint8_t in111 = seconds/8;
+	d[10]&= ~bb(in111,0,7);
+	d[11]&= ~bb(in111,8,15);
+	d[12]&= ~bb(in111,16,23);
+	d[13]&= ~bb(in111,24,31);
+	d[14]&= ~bb(in111,32,39);
+	d[15]&= ~bb(in111,40,47);
+	d[16]&= ~bb(in111,48,55);
+	d[17]&= ~bb(in111,56,59);
+}
+
+
+static void fillbefore(uint8_t in11,uint8_t value)
+{
+	uint8_t i;
+	for (i=0;i<in11;i++)
+	{
+		d[i+10]=value;
+	}
+}
+
+
+static void fillafter(uint8_t in11,uint8_t value)
+{
+	uint8_t i;
+	for (i=in11+11;i<18;i++)
+	{
+		d[i]=value;
+	}
+}
+
+
+
+
+static void SetFill(uint8_t in11,uint8_t fb2, uint8_t dd2, uint8_t fa2)
+{
+	fillbefore(in11,fb2);
+	d[in11+10]=dd2;
+	fillafter(in11,fa2);
+}
+
+
+static void growingCycle (uint8_t seconds)
+{
+	uint8_t j=refresh/19;						// /13 for 8MHz, /19 for 12MHz
+	if (j<=seconds)
+	{
+		uint8_t in1 = j/8;
+		j -= in1*8;
+		if (odd(dt.minute))
+		{
+			SetFill(in1,0xFF,p2(j),0x00);
+		}
+		else
+		{
+			SetFill(in1,0x00,~p2(j),0xFF);
+		}
+	}
+}
+
+static void redLedsOn (uint8_t in1)
+{
+	cc(0b00100001,0b10000100,0b00010000,0b01000010,0b00001000,0b00100001,0b10000100,0b00010000,in1);	// 1, 2, 5
+}
+
+
+static void redLedsAllOn ()
+{
+	d[10]=0b00100001;
+	d[11]=0b10000100;
+	d[12]=0b00010000;
+	d[13]=0b01000010;
+	d[14]=0b00001000;
+	d[15]=0b00100001;
+	d[16]=0b10000100;
+	d[17]=0b00010000;
+}
+
+
+static void setRedLed(uint8_t hour, uint8_t set)
+{
+	if(hour >= 12)
+	hour-=12;
+
+	uint8_t arrayPos = 10+((hour*5)/8);
+	uint8_t arrayValue =  (1<<(((hour*5)%8)));
+
+	if(!set)
+	{
+		//d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]= 0xFF;		// set all on
+		d[arrayPos] &= ~arrayValue;										// set red led (hour) on
+	}
+	else
+	{
+		//d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]=0;			// set all off
+		d[arrayPos] |= arrayValue;										// set red led (hour) off
+	}
+
+}
+
+
+
+static void computingLeds(void)
+{
+	//computing seconds -> multiple choices available pertaining to the design we wish
+	if( (SecMode==14) ||  ((SecMode==15) && odd(seconds)) )
+	{
+		seconds=randSec();
+	}
+	if( (SecMode==0) ||  (SecMode==10) ||  (SecMode==99) )
+	{
+		//d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]=0b00000000;	// set all ni
+		d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]=0;			// set all off
+	}
+
+	uint8_t i;
+	uint8_t in1=seconds/8;
+	uint8_t seconds2=seconds-in1*8;
+
+	switch(SecMode)
+	{
+		case 0: // don't show any led
+		//[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]=0b00000000;	// set all ni
+		break;
+
+		case 1: //seconds go normally
+		SetFill(in1,0x00,dectobin(seconds2),0x00);
+		break;
+
+		case 2: //seconds are all lit except the current one
+		SetFill(in1,0xFF,~dectobin(seconds2),0xFF);
+		break;
+
+		case 3: //seconds fill progressively
+		for (i=0;i<in1;i++)
+		SetFill(in1,0xFF,p2(seconds2),0x00);
+		break;
+
+		case 4:	//seconds empty progressively
+		SetFill(in1,0x00,~p2(seconds2),0xFF);
+		break;
+
+		case 5://seconds fill progressively at odd minutes and empty progressively at even minutes
+		if (odd(dt.minute))
+		{
+			SetFill(in1,0xFF,p2(seconds2),0x00);
+		}
+		else
+		{
+			SetFill(in1,0x00,~p2(seconds2),0xFF);
+		}
+		break;
+
+		case 6: //seconds go normally and red leds lit
+		redLedsOn(in1);
+		break;
+
+		case 7:	//seconds go normally and red leds lit. Red leds shift when the current second falls on them
+		if (seconds%5 != 0)
+		redLedsOn(in1);
+		else if (odd(seconds/5))
+		cc(0b01000010,0b00001000,0b00100001,0b10000100,0b00010000,0b01000010,0b00001000,0b00100001,in1);
+		else
+		cc(0b00010000,0b01000010,0b00001000,0b00100001,0b10000100,0b00010000,0b01000010,0b00001000,in1);
+		break;
+
+		case 8:	//seconds go normally and red leds lit. Red leds go off when the current second falls on them
+		if (seconds%5 != 0)
+		redLedsOn(in1);
+		else
+		cc(0,0,0,0,0,0,0,0,in1);
+		break;
+
+		case 9:
+		#ifdef LEDS_CASE9
+		growingCycle (seconds);
+		#endif
+		break;
+
+		#ifdef LEDS_SHOW_HOURMIN
+		// show hour and minute with leds:
+		case 10:
+		seconds = dt.minute;
+		if( (minutesOld!=seconds) || (SETSECMODE==ClockMode) )		// do only if minutes changed
+		{
+			minutesOld=seconds;
+			//d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]=0;			// set all off
+			setRedLed(dt.hour, 1);										// red led (hour on)
+			if( (seconds%5) == 0.0 )									// don't display minutes on red leds (red leds only for hours)
+			{
+				seconds--;												// displayMinutes twice then
+				displayMinutes();
+				seconds +=2;
+			}
+			displayMinutes();
+		}
+		break;
+
+		case 11:															// show hour and minute with flashing leds
+		d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]= 0xFF;			// set all on
+		if ( odd(seconds) )												// 'blinking': alternation between hour and min
+		{
+			seconds =  dt.minute;
+			if( (seconds%5) == 0 )										// don't display minutes on red leds (red leds only for hours)
+			{
+				seconds--;												// displayMinutes twice, before and after hour led
+				displayMinutesInv();
+				seconds +=2;
+			}
+			displayMinutesInv();
+		}
+		else
+		{
+			setRedLed(dt.hour, 0);										// red led (hour) off
+		}
+		break;
+		
+		
+		case 12:															// show hour (red led) and three minute (green leds) flashing
+		d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]= 0xFF;			// set all on
+		if ( odd(seconds) )												// 'blinking'
+		{
+			seconds =  dt.minute;										// set minute(s)
+			setRedLed(dt.hour, 0);										// red led (hour) off
+
+			if(seconds)
+			seconds--;
+			
+			int secExtention = seconds;
+			for(int i=seconds+3;secExtention < i ; secExtention++)
+			{
+				seconds = secExtention;
+				if(seconds>59)
+				seconds -= 59;
+
+				if(seconds%5) 											// don't display minutes on red leds (red leds only for hours)
+				{
+							displayMinutesInv();
+						}
+			}
+		}
+		break;
+
+		case 13:
+		if ( odd(seconds) )												// 'blinking'
+		{
+			seconds =  dt.minute;
+			redLedsOn(seconds/8);
+			setRedLed(dt.hour, 0);										// red led (hour off)
+		}
+		else
+		redLedsAllOn();
+
+		break;
+
+		case 14: // led's randomly
+		case 15:
+		SetFill(in1,0x00,dectobin(seconds2),0x00);
+		break;
+
+		#endif
+		#ifdef NERFGUN_MODULE
+		case 99:															// a nerf hit has count
+		//d[10]=d[11]=d[12]=d[13]=d[14]=d[15]=d[16]=d[17]= 0;				// set all off
+		if ( odd(seconds) )
+		redLedsAllOn();
+		break;
+		#endif
+		
+		default:
+		break;
+	}
+}
+
+
+//run the reference for one frame, leds[8] holds d[10..17] before and after
+uint8_t ref_computingLeds(uint8_t secMode, uint8_t second, dateTime now, uint16_t isrTicks, uint8_t *seed, uint8_t leds[8])
+{
+	uint8_t i;
+
+	for (i=0;i<8;i++)
+	d[i+10]=leds[i];
+	SecMode=secMode;
+	seconds=second;
+	dt=now;
+	refresh=isrTicks;
+	mySeed=*seed;
+	minutesOld=0xFF;						// the engine renders mode 10 on every call
+	ClockMode=0;
+
+	computingLeds();
+
+	for (i=0;i<8;i++)
+	leds[i]=d[i+10];
+	*seed=mySeed;
+	return seconds;
+}
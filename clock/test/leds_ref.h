@@ -0,0 +1,14 @@
+/******************************
+ * file name: test/leds_ref.h
+ ******************************/
+#ifndef LEDS_REF_H
+#define LEDS_REF_H
+
+#include <stdint.h>
+#include "../rtc.h"
+
+//Reference computingLeds() before the pattern engine. "isrTicks" is refresh in ticks
+//of the old Timer1 overflow ISR, "leds" is d[10..17] before and after, returns seconds.
+uint8_t ref_computingLeds(uint8_t secMode, uint8_t second, dateTime now, uint16_t isrTicks, uint8_t *seed, uint8_t leds[8]);
+
+#endif
@@ -0,0 +1,15 @@
+/******************************
+ * file name: test/stub/avr/eeprom.h
+ * host build: EEMEM variables are plain RAM
+ ******************************/
+#ifndef STUB_AVR_EEPROM_H
+#define STUB_AVR_EEPROM_H
+
+#include <string.h>
+
+#define EEMEM
+#define eeprom_busy_wait()
+#define eeprom_read_block(dst, src, n)	memcpy((dst), (src), (n))
+#define eeprom_read_byte(a)				(*(const uint8_t *)(a))
+
+#endif
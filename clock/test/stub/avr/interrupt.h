@@ -0,0 +1,17 @@
+/******************************
+ * file name: test/stub/avr/interrupt.h
+ * host build: an ISR is a plain function the test calls, cli()/sei() only toggle the I flag
+ ******************************/
+#ifndef STUB_AVR_INTERRUPT_H
+#define STUB_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)	void vector(void)
+#define ISR_NAKED
+#define ISR_NOBLOCK
+#define reti()
+#define cli()				(SREG &= ~0x80)
+#define sei()				(SREG |= 0x80)
+
+#endif
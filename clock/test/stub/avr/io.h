@@ -0,0 +1,105 @@
+/******************************
+ * file name: test/stub/avr/io.h
+ * host build: the ATmega8515 I/O registers are bytes of avr_sfr[] at their I/O addresses
+ ******************************/
+#ifndef STUB_AVR_IO_H
+#define STUB_AVR_IO_H
+
+#include <stdint.h>
+
+extern volatile uint8_t avr_sfr[0x40];
+
+#define _SFR_IO8(a)		(avr_sfr[a])
+#define _SFR_IO16(a)	(*(volatile uint16_t *)&avr_sfr[a])
+#define _SFR_IO_ADDR(r)	((uint8_t)(&(r) - avr_sfr))
+#define _BV(b)			(1<<(b))
+#define bit_is_set(r,b)		((r) & _BV(b))
+#define bit_is_clear(r,b)	(!((r) & _BV(b)))
+
+#define PINE	_SFR_IO8(0x05)
+#define DDRE	_SFR_IO8(0x06)
+#define PORTE	_SFR_IO8(0x07)
+#define PIND	_SFR_IO8(0x10)
+#define DDRD	_SFR_IO8(0x11)
+#define PORTD	_SFR_IO8(0x12)
+#define PINC	_SFR_IO8(0x13)
+#define DDRC	_SFR_IO8(0x14)
+#define PORTC	_SFR_IO8(0x15)
+#define PINB	_SFR_IO8(0x16)
+#define DDRB	_SFR_IO8(0x17)
+#define PORTB	_SFR_IO8(0x18)
+#define PINA	_SFR_IO8(0x19)
+#define DDRA	_SFR_IO8(0x1A)
+#define PORTA	_SFR_IO8(0x1B)
+#define EECR	_SFR_IO8(0x1C)
+#define EEDR	_SFR_IO8(0x1D)
+#define EEAR	_SFR_IO16(0x1E)
+#define ICR1	_SFR_IO16(0x24)
+#define OCR1B	_SFR_IO16(0x28)
+#define OCR1A	_SFR_IO16(0x2A)
+#define TCNT1	_SFR_IO16(0x2C)
+#define TCCR1B	_SFR_IO8(0x2E)
+#define TCCR1A	_SFR_IO8(0x2F)
+#define OCR0	_SFR_IO8(0x31)
+#define TCNT0	_SFR_IO8(0x32)
+#define TCCR0	_SFR_IO8(0x33)
+#define MCUCR	_SFR_IO8(0x35)
+#define EMCUCR	_SFR_IO8(0x36)
+#define TIFR	_SFR_IO8(0x38)
+#define TIMSK	_SFR_IO8(0x39)
+#define GIFR	_SFR_IO8(0x3A)
+#define GICR	_SFR_IO8(0x3B)
+#define SREG	_SFR_IO8(0x3F)
+
+#define PB0		0
+#define PB1		1
+#define PB2		2
+#define PB3		3
+#define PB4		4
+#define PD2		2
+#define PD3		3
+#define PE0		0
+
+#define CS00	0
+#define CS01	1
+#define CS02	2
+#define WGM01	3
+#define COM00	4
+#define COM01	5
+#define WGM00	6
+#define WGM10	0
+#define WGM11	1
+#define CS10	0
+#define CS11	1
+#define CS12	2
+#define WGM12	3
+#define WGM13	4
+#define OCIE0	0
+#define TOIE0	1
+#define OCIE1B	5
+#define OCIE1A	6
+#define TOIE1	7
+#define OCF0	0
+#define OCF1B	5
+#define OCF1A	6
+#define TOV1	7
+#define ISC00	0
+#define ISC01	1
+#define ISC10	2
+#define ISC11	3
+#define SM1		4
+#define SE		5
+#define SM0		7
+#define ISC2	0
+#define INT2	5
+#define INT0	6
+#define INT1	7
+#define INTF2	5
+#define INTF0	6
+#define INTF1	7
+#define EERE	0
+#define EEWE	1
+#define EEMWE	2
+#define EERIE	3
+
+#endif
@@ -0,0 +1,16 @@
+/******************************
+ * file name: test/stub/avr/pgmspace.h
+ * host build: PROGMEM data is plain RAM
+ ******************************/
+#ifndef STUB_AVR_PGMSPACE_H
+#define STUB_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(a)		(*(const uint8_t *)(a))
+#define pgm_read_word(a)		(*(const uint16_t *)(a))
+#define memcpy_P(dst, src, n)	memcpy((dst), (src), (n))
+
+#endif
@@ -0,0 +1,10 @@
+/******************************
+ * file name: test/stub/util/delay.h
+ ******************************/
+#ifndef STUB_UTIL_DELAY_H
+#define STUB_UTIL_DELAY_H
+
+#define _delay_ms(ms)
+#define _delay_us(us)
+
+#endif
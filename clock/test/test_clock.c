@@ -0,0 +1,659 @@
+/******************************
+ * file name: test/test_clock.c
+ * host checks of the pure logic of clock.c, built and run by "make" in this directory.
+ * clock.c is included, so its static state and ISRs are reachable; the AVR headers
+ * come from stub/ and the drivers for the DS1302, DS18B20, EEPROM and buzzer are faked below.
+ ******************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define main clock_main
+#include "../clock.c"
+#undef main
+
+#include "leds_ref.h"
+
+volatile uint8_t avr_sfr[0x40] __attribute__((aligned(2)));
+
+static unsigned checks, failures;
+
+#define CHECK(cond, ...)								\
+	do													\
+	{													\
+		checks++;										\
+		if (!(cond))									\
+		{												\
+			if (++failures <= 20)						\
+			{											\
+				printf("%s:%d: ", __FILE__, __LINE__);	\
+				printf(__VA_ARGS__);					\
+				printf("\n");							\
+			}											\
+		}												\
+	} while (0)
+
+//---------------------------------------------------------------------------------
+//fakes of the drivers
+
+static dateTime fakeNow;
+static uint8_t fakeRtcRam[RTC_RAM_SIZE];
+
+void rtc_init(void) {}
+dateTime rtc_now(void) { return fakeNow; }
+uint8_t rtc_tick(void) { return 0; }
+dateTime get_date_time(void) { return fakeNow; }
+void set_date_time(dateTime now) { fakeNow = now; }
+void rtc_ram_read(uint8_t *buf, uint8_t length) { memcpy(buf, fakeRtcRam, length); }
+void rtc_ram_write(const uint8_t *buf, uint8_t length) { memcpy(fakeRtcRam, buf, length); }
+uint8_t ds18b20_update() { return 21; }
+uint8_t ds18b20_gettemp() { return 21; }
+void buzzer_init(void) {}
+void buzzer_tick(void) {}
+void buzzer_play(uint8_t pattern) {}
+void buzzer_loop(uint8_t pattern) {}
+void buzzer_stop(void) {}
+uint8_t buzzer_busy(void) { return 0; }
+
+//the EEPROM queue writes at once and logs the order of the writes
+static uint8_t *eeLastWrite;
+void ee_queue_byte(uint8_t *address, uint8_t data)
+{
+	*address = data;
+	eeLastWrite = address;
+}
+void ee_queue_block(const void *src, void *dst, uint8_t length)
+{
+	memcpy(dst, src, length);
+	eeLastWrite = (uint8_t *)dst + length - 1;
+}
+
+//---------------------------------------------------------------------------------
+
+static uint32_t lcg = 12345;
+static uint8_t random8(void)
+{
+	lcg = lcg * 1103515245 + 12345;
+	return lcg >> 16;
+}
+
+//the pattern engine against computingLeds() before it, every SecMode, second and minute
+static void testLeds(void)
+{
+	uint8_t mode, sec, min, hour, j, i, ref[8], refSec, refSeed, garbage[8], lit;
+	dateTime now = {0, 0, 0, 1, 1, 0, 20};
+
+	for (mode=0; mode<16; mode++)
+	for (hour=0; hour<24; hour+=(mode>=10 && mode<=13) ? 1 : 7)
+	for (min=0; min<60; min++)
+	for (sec=0; sec<60; sec++)
+	for (j=0; j<=((mode==9) ? 60 : 0); j++)
+	{
+		for (i=0; i<8; i++)
+		garbage[i] = random8();						// rows the mode leaves alone stay as they were
+		memcpy(ref, garbage, 8);
+		memcpy(&d[10], garbage, 8);
+		now.second = sec;
+		now.minute = min;
+		now.hour = hour;
+		dt = now;
+		SecMode = mode;
+		seconds = sec;
+		refresh = 6*j;								// ms now, growing cycle step is 6ms
+		mySeed = refSeed = random8() | 1;
+		refSec = ref_computingLeds(mode, sec, now, 19*j, &refSeed, ref);	// ISR ticks then, step 19
+		computingLeds();
+
+		if ( (mode==3) && (sec<8) )
+		{
+			//the old mode 3 left the first row stale in the first 8 seconds
+			CHECK( (d[10]==p2(sec)) && !d[11] && !d[17], "mode 3 second %u", sec);
+			continue;
+		}
+		CHECK(memcmp(&d[10], ref, 8)==0, "mode %u %02u:%02u:%02u step %u: %02X %02X %02X %02X %02X %02X %02X %02X, was %02X %02X %02X %02X %02X %02X %02X %02X",
+		mode, hour, min, sec, j, d[10], d[11], d[12], d[13], d[14], d[15], d[16], d[17],
+		ref[0], ref[1], ref[2], ref[3], ref[4], ref[5], ref[6], ref[7]);
+		CHECK(seconds==refSec, "mode %u second %u: seconds %u, was %u", mode, sec, seconds, refSec);
+		#ifdef SKIP_EMPTY_ROWS
+		for (i=0, lit=0; i<8; i++)
+		lit += (d[10+i] != 0);
+		CHECK(lit<=pgm_read_byte(&ledRowsWorst[mode]), "mode %u %02u:%02u:%02u: %u rows lit", mode, hour, min, sec, lit);
+		#endif
+		CHECK(mySeed==refSeed, "mode %u second %u: seed %u, was %u", mode, sec, mySeed, refSeed);
+	}
+
+	//renderLeds() skips frames that do not change
+	SecMode = 1;
+	seconds = 5;
+	dt.minute = 7;
+	ledsSecond = 0xFF;
+	renderLeds();
+	d[10] = 0x55;
+	renderLeds();
+	CHECK(d[10]==0x55, "renderLeds() rendered an unchanged frame");
+	seconds = 6;
+	renderLeds();
+	CHECK(d[10]==0x40, "renderLeds() missed a new second: %02X", d[10]);
+}
+
+static void testRandSec(void)
+{
+	uint16_t seed;
+
+	for (seed=0; seed<256; seed++)
+	{
+		mySeed = seed;
+		CHECK(randSec()<60, "randSec() >= 60 from seed %u", seed);
+	}
+}
+
+static uint8_t leapYear(uint16_t y)
+{
+	return ( (y % 4 == 0) && (y % 100 != 0) ) || (y % 400 == 0);
+}
+
+//days from 1.1.2000
+static uint16_t dayNumber(dateTime t)
+{
+	static const uint8_t monthDays[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
+	uint16_t n=0, y;
+	uint8_t m;
+
+	for (y=2000; y<2000+t.year; y++)
+	n += 365 + leapYear(y);
+	for (m=1; m<t.month; m++)
+	n += monthDays[m-1] + ((m==2) && leapYear(2000+t.year));
+	return n + t.date - 1;
+}
+
+static void testDaysBetweenDates(void)
+{
+	static const uint8_t monthDays[12] = {31,29,31,30,31,30,31,31,30,31,30,31};
+	dateTime a = {0}, b = {0};
+	uint16_t n, expect;
+
+	for (n=0; n<20000; n++)
+	{
+		a.year = 10 + random8() % 40;
+		a.month = 1 + random8() % 12;
+		a.date = 1 + random8() % monthDays[a.month-1];
+		if ( (a.month==2) && (a.date==29) && !leapYear(2000+a.year) )
+		a.date = 28;
+		b.year = (n & 1) ? a.year : 10 + random8() % 40;
+		b.month = 1 + random8() % 12;
+		b.date = 1 + random8() % monthDays[b.month-1];
+		if ( (b.month==2) && (b.date==29) && !leapYear(2000+b.year) )
+		b.date = 28;
+
+		expect = (dayNumber(a) > dayNumber(b)) ? dayNumber(a) - dayNumber(b) : dayNumber(b) - dayNumber(a);
+		CHECK(daysBetweenDates(a, b)==expect, "%u.%u.%u - %u.%u.%u: %u, not %u",
+		a.date, a.month, a.year, b.date, b.month, b.year, daysBetweenDates(a, b), expect);
+	}
+}
+
+//temperatures of the DS18B20 driver: 0..100 = 0..100C, 101..127 = -27..-1C
+static void testConvertCToF(void)
+{
+	uint8_t c;
+	int16_t celsius, fahrenheit;
+
+	for (c=0; c<128; c++)
+	{
+		celsius = (c>100) ? c-128 : c;
+
+		USMode = 0;
+		CHECK( (ConvertCToF(c)==((celsius<0) ? -celsius : celsius)) && (tempsign==(celsius<0)),
+		"%dC shown as %u sign %u", celsius, ConvertCToF(c), tempsign);
+
+		USMode = 1;
+		fahrenheit = (celsius<0) ? 32 - (-celsius)*9/5 : celsius*9/5 + 32;
+		CHECK( (ConvertCToF(c)==((fahrenheit<0) ? -fahrenheit : fahrenheit)) && (tempsign==(fahrenheit<0)),
+		"%dC shown as %uF sign %u, not %dF", celsius, ConvertCToF(c), tempsign, fahrenheit);
+	}
+	USMode = 0;
+}
+
+//the digits and their port images in the slot table
+static void testDisplay(void)
+{
+	uint8_t i;
+
+	SecMode = 0;
+	Dim = 0;
+	pulsing = 0;
+	USMode = 0;
+	menu = MENU_NONE;
+	refresh = 0;
+
+	ClockMode = SHOWCLOCK;
+	digit = 1234;
+	display();
+	CHECK( (d[0]==seg[1]) && (d[1]==(seg[2]|SEG_dot)) && (d[2]==seg[3]) && (d[3]==seg[4]), "12:34");
+	for (i=0; i<4; i++)
+	CHECK( (slots[i].a==(uint8_t)~d[i]) && (slots[i].c==0xFF) && (slots[i].d==(uint8_t)(0xFC & ~(1<<(i+4)))),
+	"slot of digit %u: %02X %02X %02X", i, slots[i].a, slots[i].c, slots[i].d);
+
+	digit = 905;
+	refresh = 500;
+	display();
+	CHECK( (d[0]==SEG_NULL) && (d[1]==seg[9]) && (d[2]==seg[0]) && (d[3]==seg[5]), "9:05 without the dot");
+
+	USMode = 1;
+	digit = 1307;
+	display();
+	CHECK( (d[0]==SEG_NULL) && (d[1]==seg[1]) && (d[2]==seg[0]) && (d[3]==seg[7]), "13:07 in 12h mode");
+	USMode = 0;
+
+	ClockMode = SHOWTEMP;
+	digit = 23;
+	tempsign = 0;
+	display();
+	CHECK( (d[0]==SEG_NULL) && (d[1]==seg[2]) && (d[2]==seg[3]) && (d[3]==seg[12]), "23C");
+	digit = 5;
+	tempsign = 1;
+	display();
+	CHECK( (d[0]==seg[23]) && (d[1]==SEG_NULL) && (d[2]==seg[5]) && (d[3]==seg[12]), "-5C");
+	USMode = 1;
+	digit = 104;
+	tempsign = 0;
+	display();
+	CHECK( (d[0]==seg[1]) && (d[1]==seg[0]) && (d[2]==seg[4]) && (d[3]==seg[14]), "104F");
+	USMode = 0;
+
+	ClockMode = SHOWYEAR;
+	digit = 2019;
+	display();
+	CHECK( (d[0]==seg[2]) && (d[1]==seg[0]) && (d[2]==seg[1]) && (d[3]==seg[9]), "2019");
+
+	ClockMode = SETAL;
+	ALSet = 1;
+	display();
+	CHECK( (d[0]==seg[15]) && (d[1]==seg[13]) && (d[2]==seg[16]), "alarm on");
+
+	ClockMode = SETDIMMODE;
+	DimMode = DIMAUTO;
+	display();
+	CHECK(d[3]==seg[17], "dim mode auto");
+	DimMode = 12;
+	display();
+	CHECK( (d[2]==seg[1]) && (d[3]==seg[2]), "dim mode 12");
+
+	//the lit led rows follow the digits, SecMode 1 lights one row at most: the digits get a second
+	//pass, the rest are idle slots at the end
+	ClockMode = SHOWCLOCK;
+	SecMode = 1;
+	seconds = 17;
+	ledsSecond = 0xFF;
+	display();
+	#ifdef SKIP_EMPTY_ROWS
+	CHECK( (slots[4].a==(uint8_t)~0x02) && (slots[4].c==(uint8_t)~(1<<2)) && (slots[4].d==0xFC),
+	"led slot of second 17: %02X %02X %02X", slots[4].a, slots[4].c, slots[4].d);
+	for (i=0; i<4; i++)
+	CHECK( (slots[i+5].a==slots[i].a) && (slots[i+5].c==0xFF) && (slots[i+5].d==slots[i].d), "second pass of digit %u", i);
+	for (i=9; i<SLOTS; i++)
+	CHECK( (slots[i].a==0xFF) && (slots[i].c==0xFF) && (slots[i].d==0xFC), "idle slot %u", i);
+	CHECK( (slotVisits[0]==2) && (slotVisits[4+2]==1) && (slotVisits[4]==0), "slot visits");
+
+	//the same digit on-time without a lit row
+	SecMode = 0;
+	display();
+	for (i=4; i<SLOTS; i++)
+	CHECK(slots[i].d==slots[i%4].d, "SecMode 0: digit pass in slot %u", i);
+	CHECK(slotVisits[3]==3, "SecMode 0: digit visits %u", slotVisits[3]);
+
+	//more rows than the slots the digits leave over are dropped, not written past the table
+	SecMode = 14;
+	display();
+	for (i=10; i<18; i++)
+	d[i] = 0x01;
+	buildSlots();
+	for (i=0; i<4; i++)
+	CHECK( (slots[i+4].c==(uint8_t)~(1<<i)) && (slots[i+8].d==slots[i].d), "rows beyond the worst case, slot %u", i+4);
+	SecMode = 1;
+	#else
+	CHECK( (slots[6].a==(uint8_t)~0x02) && (slots[6].c==(uint8_t)~(1<<2)), "led slot of second 17");
+	#endif
+}
+
+#ifdef PWMDIM_MODULE
+//compare A blanks the slot, compare B loads it for the gamma on-time before the next compare A
+static void testDim(void)
+{
+	uint16_t onTime, last;
+	uint8_t i;
+
+	setRefresh(DefRefresh);
+	Dim = 0;
+	setOnTime();
+	CHECK( (slotOnTime==slotPeriod) && !(TIMSK & (1<<OCIE1B)), "full brightness without compare B");
+	digit_addressed = 0;
+	TIMER1_COMPA_vect();
+	CHECK( (PORTA==slots[0].a) && (PORTC==slots[0].c) && (PORTD==slots[0].d), "compare A loads at full brightness");
+
+	last = slotPeriod;
+	for (Dim=1; Dim<DIMLEVELS; Dim++)
+	{
+		setOnTime();
+		onTime = ((uint32_t)slotPeriod * pgm_read_word(&dimOnTime[Dim])) >> 9;
+		CHECK( (slotOnTime==onTime) && (onTime<last) && (onTime>0), "Dim %u: on-time %u", Dim, slotOnTime);
+		CHECK( (OCR1B==slotPeriod-1-onTime) && (TIMSK & (1<<OCIE1B)), "Dim %u: OCR1B %u", Dim, OCR1B);
+		last = onTime;
+	}
+
+	Dim = 8;
+	setOnTime();
+	for (i=0; i<SLOTS; i++)
+	{
+		PORTA = 0x55;
+		digit_addressed = i;
+		TIMER1_COMPA_vect();
+		CHECK( (PORTC==0xFF) && (PORTD==0xFC) && (PORTA==0x55), "compare A blanks slot %u", i);
+		TIMER1_COMPB_vect();
+		CHECK( (PORTA==slots[i].a) && (PORTC==slots[i].c) && (PORTD==slots[i].d), "compare B loads slot %u", i);
+	}
+	Dim = 0;
+	setOnTime();
+}
+#endif
+
+//PLUS in SETREFRESH steps the profiles, the slot period and the dimmed on-time follow
+static void testRefresh(void)
+{
+	uint8_t i, profile;
+
+	setRefresh(DefRefresh);
+	Dim = 3;
+	ClockMode = SETREFRESH;
+	for (i=0; i<=MaxRefresh+1; i++)
+	{
+		profile = (DefRefresh+1+i) % (MaxRefresh+1);
+		plusKeyPressed(1);
+		CHECK( (refreshProfile==profile) && (OCR1A==pgm_read_word(&slotPeriods[profile])-1), "PLUS %u: profile %u, OCR1A %u", i, refreshProfile, OCR1A);
+		#ifdef PWMDIM_MODULE
+		CHECK(OCR1B==slotPeriod-1-slotOnTime, "PLUS %u: OCR1B %u", i, OCR1B);
+		#endif
+		display();
+		CHECK(d[3]==seg[pgm_read_byte(&refreshRates[profile])%10], "PLUS %u: shown rate", i);
+	}
+	Dim = 0;
+	setRefresh(DefRefresh);
+	ClockMode = SHOWCLOCK;
+}
+
+//Timer0 counts 187.5 per ms on average, every ms is counted
+static void testTimeBase(void)
+{
+	uint32_t counts=0, ms=msTicks;
+	uint16_t i;
+
+	PIND = 0xFF;										// no keys, sampled every 10 ms
+	OCR0 = MSOCR0;
+	for (i=0; i<2000; i++)
+	{
+		counts += OCR0 + 1;
+		TIMER0_COMP_vect();
+	}
+	CHECK(counts*1000 == 2000UL*(F_CPU/64), "Timer0 counts of 2000 ms: %lu", (unsigned long)counts);
+	CHECK(msTicks-ms == 2000, "ms counted: %lu", (unsigned long)(msTicks-ms));
+}
+
+//CRC-8 as on the 1-Wire bus, one bit at a time
+static uint8_t crc8Bitwise(const uint8_t *data, uint8_t length)
+{
+	uint8_t crc=0, i;
+
+	while (length--)
+	{
+		crc ^= *data++;
+		for (i=0; i<8; i++)
+		crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+	}
+	return crc;
+}
+
+static void testCrc8(void)
+{
+	uint8_t buf[32], n, i;
+
+	for (n=0; n<200; n++)
+	{
+		for (i=0; i<sizeof(buf); i++)
+		buf[i] = random8();
+		CHECK(crc8(buf, n % sizeof(buf))==crc8Bitwise(buf, n % sizeof(buf)), "crc8() of %u bytes", n % 32);
+	}
+	CHECK(crc8((const uint8_t *)&defaultSettings, sizeof(settings)-1)==defaultSettings.crc, "CRC of the default record");
+}
+
+static void putRecord(uint8_t slot, uint8_t sequence, uint8_t secMode)
+{
+	settings r = defaultSettings;
+
+	r.sequence = sequence;
+	r.SecMode = secMode;
+	r.crc = crc8((uint8_t *)&r, sizeof(settings)-1);
+	ESettings[slot] = r;
+}
+
+static void testSettings(void)
+{
+	//erased EEPROM: defaults, the first record goes to slot 0
+	memset(ESettings, 0xFF, sizeof(ESettings));
+	loadSettings();
+	CHECK( (SecMode==DefSecMode) && (ALHours==DefALHours) && (storedSlot==SETTINGSSLOTS-1), "defaults");
+
+	//the newest record wins
+	putRecord(3, 5, 7);
+	putRecord(4, 6, 8);
+	loadSettings();
+	CHECK( (SecMode==8) && (storedSlot==4), "newest record: mode %u slot %u", SecMode, storedSlot);
+
+	//a torn record is skipped
+	ESettings[4].ALHours ^= 1;
+	loadSettings();
+	CHECK( (SecMode==7) && (storedSlot==3), "torn record: mode %u slot %u", SecMode, storedSlot);
+
+	//the sequence wraps
+	memset(ESettings, 0xFF, sizeof(ESettings));
+	putRecord(SETTINGSSLOTS-1, 255, 4);
+	putRecord(0, 0, 5);
+	loadSettings();
+	CHECK( (SecMode==5) && (storedSlot==0), "wrapped sequence: mode %u slot %u", SecMode, storedSlot);
+
+	//a change appends the next record, its sequence is written last
+	SecModeOld = 11;
+	storeSettings();
+	CHECK( (storedSlot==1) && (eeLastWrite==&ESettings[1].sequence) && (ESettings[1].sequence==1), "store order");
+	SecModeOld = 0;
+	loadSettings();
+	CHECK( (SecMode==11) && (storedSlot==1), "stored record: mode %u slot %u", SecMode, storedSlot);
+
+	//the refresh profile is stored and selected again
+	setRefresh(REFRESH100);
+	storeSettings();
+	setRefresh(DefRefresh);
+	loadSettings();
+	CHECK( (refreshProfile==REFRESH100) && (slotPeriod==pgm_read_word(&slotPeriods[REFRESH100])), "stored refresh %u", refreshProfile);
+	setRefresh(DefRefresh);
+	storeSettings();
+
+	//nothing changed, nothing written
+	eeLastWrite = 0;
+	storeSettings();
+	CHECK(eeLastWrite==0, "unchanged settings written");
+}
+
+//the hot state survives a reset in the DS1302 RAM and reaches the EEPROM at the full hour
+static void testHot(void)
+{
+	memset(fakeRtcRam, 0, sizeof(fakeRtcRam));
+	loadSettings();
+	storeDirty = 0;
+	loadHot();
+	CHECK( (hot.magic==0) && (!storeDirty), "empty DS1302 RAM is ignored");
+
+	SecModeOld = 9;
+	DimMode = 2;
+	setRefresh(REFRESH150);
+	dt.minute = 30;
+	storeHot();
+	CHECK(fakeRtcRam[0]==HOTMAGIC, "hot state written");
+
+	//reset: the EEPROM has the old values, the DS1302 RAM the new ones
+	loadSettings();
+	loadHot();
+	CHECK( (SecMode==9) && (DimMode==2) && (refreshProfile==REFRESH150) && (storeDirty), "hot state restored: mode %u dim %u refresh %u", SecMode, DimMode, refreshProfile);
+
+	//flushed to EEPROM at the full hour only
+	eeLastWrite = 0;
+	storeHot();
+	CHECK(eeLastWrite==0, "EEPROM written before the full hour");
+	dt.minute = 0;
+	dt.second = 0;
+	storeHot();
+	CHECK( (eeLastWrite!=0) && (!storeDirty) && (stored.SecMode==9) && (stored.refresh==REFRESH150), "hot state flushed at the full hour");
+
+	//a torn hot state is ignored
+	fakeRtcRam[2] ^= 1;
+	SecMode = 0;
+	loadHot();
+	CHECK( (hot.magic==0) && (SecMode==0), "torn hot state used");
+
+	memset(fakeRtcRam, 0, sizeof(fakeRtcRam));
+	SecMode = SecModeOld = DefSecMode;
+	DimMode = Dim = 0;
+	setRefresh(DefRefresh);
+	storeSettings();
+}
+
+//next key event of the queue, 0 if none
+static uint8_t keyNext(void)
+{
+	uint8_t event;
+
+	if (keyTail==keyHead)
+	return 0;
+	event = keyQueue[keyTail];
+	keyTail = (keyTail+1) & (KEYQUEUE-1);
+	return event;
+}
+
+//sample the keys "n" times with "pins" low and return the events, at most 8
+static uint8_t keySample(uint8_t pins, uint16_t n, uint8_t *events)
+{
+	uint8_t count=0, event;
+
+	PIND = 0xFF & ~pins;
+	while (n--)
+	{
+		keysSample();
+		while ( (event = keyNext()) )
+		if (count < 8)
+		events[count++] = event;
+	}
+	return count;
+}
+
+static void testKeys(void)
+{
+	uint8_t ev[8], n, i;
+
+	keyAccel = 0;
+	n = keySample(0, 10, ev);
+	CHECK(n==0, "events without keys");
+
+	//a bouncing key is ignored
+	for (i=0; i<20; i++)
+	n = keySample((i & 1) ? (1<<KEYSELECT) : 0, 1, ev);
+	CHECK( (n==0) && (keysDown==0), "bouncing key");
+
+	//press after the debounce time, repeat, long press, release
+	n = keySample(1<<KEYSELECT, KEYDEBOUNCE+1, ev);
+	CHECK( (n==1) && (ev[0]==(KEV_PRESS|KEY_PLUS)), "press: %u events, %02X", n, ev[0]);
+	n = keySample(1<<KEYSELECT, KEYREPEATDELAY, ev);
+	CHECK( (n==1) && (ev[0]==(KEV_REPEAT|KEY_PLUS)), "first repeat: %u events", n);
+	n = keySample(1<<KEYSELECT, KEYLONG-KEYREPEATDELAY, ev);
+	CHECK( (n==5) && (ev[3]==(KEV_LONG|KEY_PLUS)), "long press: %u events, %02X", n, ev[3]);
+	n = keySample(1<<KEYSELECT, KEYLONG, ev);
+	CHECK( (n==6) && (ev[4]==(KEV_LONG|KEY_PLUS)), "second long press: %u events, %02X", n, ev[4]);
+	n = keySample(0, KEYDEBOUNCE+1, ev);
+	CHECK( (n==1) && (ev[0]==(KEV_RELEASE|KEY_PLUS)) && !keysDown, "release: %u events, %02X", n, ev[0]);
+
+	//the second key makes it a press of both
+	n = keySample(1<<KEYSET, KEYDEBOUNCE+1, ev);
+	n = keySample((1<<KEYSET)|(1<<KEYSELECT), KEYDEBOUNCE+1, ev);
+	CHECK( (n==1) && (ev[0]==(KEV_PRESS|KEY_BOTH)), "both keys: %u events, %02X", n, ev[0]);
+	n = keySample(0, KEYDEBOUNCE+1, ev);
+	CHECK( (n==1) && (ev[0]==(KEV_RELEASE|KEY_BOTH)), "release both");
+
+	//PLUS in a numeric set mode jumps by 10 after KEYJUMP
+	keyAccel = 1;
+	n = keySample(1<<KEYSELECT, KEYDEBOUNCE+1+KEYJUMP, ev);
+	n = keySample(1<<KEYSELECT, KEYREPEATFAST, ev);
+	CHECK( (n==1) && (ev[0]==(KEV_REPEAT|KEV_JUMP|KEY_PLUS)), "jump: %u events, %02X", n, ev[0]);
+	n = keySample(0, KEYDEBOUNCE+1, ev);
+	keyAccel = 0;
+}
+
+//hold MODE "n" samples in SHOWCLOCK, release it and return the mode entered
+static uint8_t menuHold(uint16_t n)
+{
+	uint16_t i;
+
+	ClockMode = SHOWCLOCK;
+	menu = MENU_NONE;
+	PIND = 0xFF & ~(1<<KEYSET);
+	for (i=0; i<KEYDEBOUNCE+n; i++)
+	{
+		keysSample();
+		taskKeys();
+	}
+	PIND = 0xFF;
+	for (i=0; i<KEYDEBOUNCE+1; i++)
+	{
+		keysSample();
+		taskKeys();
+	}
+	return ClockMode;
+}
+
+//MODE held in SHOWCLOCK steps the menu with its long presses, released enters the entry
+static void testMenu(void)
+{
+	static const struct { uint16_t held; uint8_t mode; } hold[] =
+	{
+		{ 1, SHOWDATE }, { KEYLONG/2, SHOWDATE }, { 3*KEYLONG/2, SETALMINUTES },
+		{ 5*KEYLONG/2, SETSECMODE }, { 7*KEYLONG/2, SETDIMMODE },
+		{ 9*KEYLONG/2, SETREFRESH }, { 11*KEYLONG/2, SETYEAR }, { 12*KEYLONG, SETYEAR },
+	};
+	uint8_t i, mode;
+
+	for (i=0; i<sizeof(hold)/sizeof(hold[0]); i++)
+	{
+		mode = menuHold(hold[i].held);
+		CHECK( (mode==hold[i].mode) && (menu==MENU_NONE), "MODE held %u: mode %02X, expected %02X", hold[i].held, mode, hold[i].mode);
+	}
+	ClockMode = SHOWCLOCK;
+}
+
+int main(void)
+{
+	testLeds();
+	testRandSec();
+	testDaysBetweenDates();
+	testConvertCToF();
+	testDisplay();
+	#ifdef PWMDIM_MODULE
+	testDim();
+	#endif
+	testRefresh();
+	testCrc8();
+	testSettings();
+	testHot();
+	testTimeBase();
+	testKeys();
+	testMenu();
+
+	printf("%u checks, %u failed\n", checks, failures);
+	return failures != 0;
+}